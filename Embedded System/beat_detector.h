@@ -0,0 +1,257 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include "dsp.h"
+
+// ================================================================
+// STREAMING PAN-TOMPKINS BEAT DETECTOR (FIXED POINT)
+// ================================================================
+// Sample-by-sample version of the host pipeline in filtering.py:
+//   bandpass (0.7–10 Hz, 4th-order HP + 4th-order LP biquad cascade)
+//   -> derivative -> square -> running-sum integrator (0.15 s)
+//   -> adaptive-threshold peak picker with a 0.65 s refractory window
+// IR and Red share one two-lane Q31 biquad cascade from dsp.h; only design
+// (once, in begin()) and the periodic summary use floating point. The pipeline is
+// causal, so beats are reported with a constant delay; the integrator half-
+// window is compensated, RR intervals are unaffected by the rest.
+
+const float BD_BANDPASS_LOW        = 0.7f;
+const float BD_BANDPASS_HIGH       = 10.0f;
+const float BD_INTEGRATION_SEC     = 0.15f;
+const float BD_MIN_PEAK_DIST_SEC   = 0.65f;
+const float BD_SETTLE_SEC          = 1.0f;     // Filter start-up transient, ignored (host trims 1 s too)
+const float BD_LEARNING_SEC        = 2.0f;     // Threshold training before the first beat
+const int   BD_MAX_WINDOW          = 256;      // Integrator window buffer (>= 0.15 s at 1.7 kHz)
+const int   BD_INPUT_SHIFT         = 8;        // 18-bit samples -> 26-bit filter domain
+const int   BD_RR_RESET_REJECTS    = 4;        // Re-learn RR after this many rejected intervals
+
+struct BeatEvent {
+  uint32_t index;        // Absolute sample index of the beat
+  uint16_t rrMs;         // Interval to the previous beat (0 = first beat / after a gap)
+};
+
+struct MetricsSummary {
+  uint32_t index;        // Absolute sample index at the end of the window
+  uint16_t hrX10;        // Mean HR over accepted RR intervals, bpm x10 (0 = none)
+  uint16_t spo2X10;      // SpO2 estimate, % x10 (0 = not available)
+  uint16_t rmssdX10;     // RMSSD, ms x10
+  uint8_t  beats;        // Beats detected in the window
+};
+
+class BeatDetector {
+public:
+  void begin(int sampleRate) {
+    fs_ = sampleRate;
+    float fs = (float)sampleRate;
+    band_.setStage(0, BiquadCoeffs::highpass(BD_BANDPASS_LOW, fs, 0.5412f));
+    band_.setStage(1, BiquadCoeffs::highpass(BD_BANDPASS_LOW, fs, 1.3066f));
+    band_.setStage(2, BiquadCoeffs::lowpass(BD_BANDPASS_HIGH, fs, 0.5412f));
+    band_.setStage(3, BiquadCoeffs::lowpass(BD_BANDPASS_HIGH, fs, 1.3066f));
+    integrator_.begin((int)(BD_INTEGRATION_SEC * sampleRate + 0.5f));
+    window_ = integrator_.length();
+    minDist_  = (uint32_t)(BD_MIN_PEAK_DIST_SEC * sampleRate);
+    settle_   = (uint32_t)(BD_SETTLE_SEC * sampleRate);
+    learning_ = settle_ + (uint32_t)(BD_LEARNING_SEC * sampleRate);
+    sqClamp_  = 0xFFFFFFFFUL / (uint32_t)window_;
+    reset();
+  }
+
+  void reset() {
+    band_.reset();
+    integrator_.reset();
+    integ_ = integPrev1_ = integPrev2_ = 0;
+    bpPrev1_ = bpPrev2_ = 0;
+    seen_ = 0;
+    learnMax_ = 0;
+    learnSum_ = 0;
+    spki_ = npki_ = 0;
+    haveCandidate_ = false;
+    haveLastBeat_ = false;
+    haveNext_ = false;
+    rrAvg_ = 0;
+    rrRejects_ = 0;
+    dcIr_ = dcRed_ = 0;
+    acIrPow_ = acRedPow_ = 0;
+    started_ = false;
+    resetWindow();
+  }
+
+  // Feeds one sample; returns true (and fills beat) when a beat is confirmed
+  bool process(uint32_t index, uint32_t ir, uint32_t red, BeatEvent& beat) {
+    if (haveNext_ && index != nextIndex_) haveLastBeat_ = false;   // Gap – no RR across it
+    nextIndex_ = index + 1;
+    haveNext_  = true;
+    lastIndex_ = index;
+
+    int32_t xIr  = (int32_t)(ir  << BD_INPUT_SHIFT);
+    int32_t xRed = (int32_t)(red << BD_INPUT_SHIFT);
+    if (!started_) {
+      // Filters see the signal relative to the first sample, which keeps the
+      // high-pass start-up step (and its transient) small
+      offsetIr_ = dcIr_ = xIr;
+      offsetRed_ = dcRed_ = xRed;
+      started_ = true;
+    }
+    int32_t bpIr  = xIr - offsetIr_;
+    int32_t bpRed = xRed - offsetRed_;
+    band_.step(bpIr, bpRed);
+    trackPerfusion(xIr, xRed, bpIr, bpRed);
+
+    // Causal central difference (delay 1), back in ADC units
+    int32_t d = (bpIr - bpPrev2_) >> (BD_INPUT_SHIFT + 1);
+    bpPrev2_ = bpPrev1_;
+    bpPrev1_ = bpIr;
+
+    uint32_t sq = (uint32_t)((int64_t)d * d > sqClamp_ ? sqClamp_ : (int64_t)d * d);
+    integ_ = integrator_.push(sq);
+
+    bool found = false;
+    if (seen_ < learning_) {
+      if (seen_ >= settle_) {
+        if (integ_ > learnMax_) learnMax_ = integ_;
+        learnSum_ += integ_;
+      }
+      if (++seen_ == learning_) {
+        spki_ = learnMax_ / 3;
+        npki_ = (uint32_t)(learnSum_ / (learning_ - settle_)) / 2;
+      }
+    } else {
+      // Local maximum of the integrated signal at index - 1
+      if (integPrev1_ > integPrev2_ && integPrev1_ >= integ_) {
+        onLocalMax(index - 1, integPrev1_);
+      }
+      found = confirmCandidate(index, beat);
+    }
+    integPrev2_ = integPrev1_;
+    integPrev1_ = integ_;
+    return found;
+  }
+
+  // Closes the current summary window and starts a new one
+  MetricsSummary summary() {
+    MetricsSummary s;
+    s.index = lastIndex_;
+    s.beats = winBeats_ > 255 ? 255 : (uint8_t)winBeats_;
+    s.hrX10 = winRrCount_ > 0 ? (uint16_t)(600000.0f * winRrCount_ / winRrSum_) : 0;
+    s.rmssdX10 = winDiffCount_ > 0 ? (uint16_t)(10.0f * sqrtf((float)winDiffSq_ / winDiffCount_)) : 0;
+    s.spo2X10 = 0;
+    if (dcIr_ > 0 && dcRed_ > 0 && acIrPow_ > 0) {
+      float ratioIr  = sqrtf((float)acIrPow_)  / (float)dcIr_;
+      float ratioRed = sqrtf((float)acRedPow_) / (float)dcRed_;
+      float spo2 = 110.0f - 25.0f * (ratioRed / (ratioIr + 1e-8f));
+      if (spo2 < 85.0f) spo2 = 85.0f;
+      if (spo2 > 100.0f) spo2 = 100.0f;
+      s.spo2X10 = (uint16_t)(spo2 * 10.0f);
+    }
+    resetWindow();
+    return s;
+  }
+
+private:
+  void resetWindow() {
+    winBeats_ = 0;
+    winRrCount_ = 0;
+    winRrSum_ = 0;
+    winDiffCount_ = 0;
+    winDiffSq_ = 0;
+    havePrevRr_ = false;
+  }
+
+  void trackPerfusion(int32_t xIr, int32_t xRed, int32_t bpIr, int32_t bpRed) {
+    // Running DC (single pole) and AC power (EMA of the bandpassed square)
+    dcIr_  += (xIr  - dcIr_)  >> 7;
+    dcRed_ += (xRed - dcRed_) >> 7;
+    int64_t pIr  = (int64_t)bpIr  * bpIr;
+    int64_t pRed = (int64_t)bpRed * bpRed;
+    acIrPow_  += (pIr  - acIrPow_)  >> 8;
+    acRedPow_ += (pRed - acRedPow_) >> 8;
+  }
+
+  void onLocalMax(uint32_t idx, uint32_t value) {
+    uint32_t threshold = npki_ + (spki_ > npki_ ? (spki_ - npki_) / 4 : 0);
+    if (value < threshold) {
+      npki_ = value / 8 + npki_ - npki_ / 8;
+      return;
+    }
+    if (haveLastBeat_ && idx - lastBeatIdx_ < minDist_) return;   // Refractory
+    // Within the refractory span of an unconfirmed candidate the larger peak wins
+    if (!haveCandidate_ || value > candidateValue_) {
+      candidateIdx_   = idx;
+      candidateValue_ = value;
+      haveCandidate_  = true;
+    }
+  }
+
+  bool confirmCandidate(uint32_t index, BeatEvent& beat) {
+    if (!haveCandidate_ || index - candidateIdx_ < minDist_) return false;
+    haveCandidate_ = false;
+    spki_ = candidateValue_ / 8 + spki_ - spki_ / 8;
+
+    uint32_t delay = (uint32_t)(window_ / 2 + 1);   // Integrator half-window + derivative
+    beat.index = candidateIdx_ > delay ? candidateIdx_ - delay : 0;
+    beat.rrMs  = 0;
+    if (haveLastBeat_) {
+      uint32_t rr = (candidateIdx_ - lastBeatIdx_) * 1000UL / (uint32_t)fs_;
+      beat.rrMs = rr > 0xFFFF ? 0xFFFF : (uint16_t)rr;
+      acceptRr(rr);
+    }
+    lastBeatIdx_  = candidateIdx_;
+    haveLastBeat_ = true;
+    winBeats_++;
+    return true;
+  }
+
+  void acceptRr(uint32_t rr) {
+    // Same 0.7–1.5 x band as the host, against a running average instead of a median
+    bool ok = rrAvg_ == 0 || (rr * 10 > rrAvg_ * 7 && rr * 10 < rrAvg_ * 15);
+    if (!ok && ++rrRejects_ < BD_RR_RESET_REJECTS) {
+      havePrevRr_ = false;
+      return;
+    }
+    rrRejects_ = 0;
+    rrAvg_ = rrAvg_ == 0 || !ok ? rr : (rrAvg_ * 7 + rr) / 8;
+
+    winRrCount_++;
+    winRrSum_ += rr;
+    if (havePrevRr_) {
+      int32_t diff = (int32_t)rr - (int32_t)prevRr_;
+      winDiffSq_ += (uint64_t)((int64_t)diff * diff);
+      winDiffCount_++;
+    }
+    prevRr_ = rr;
+    havePrevRr_ = true;
+  }
+
+  int fs_ = 200;
+  int window_ = 30;
+  uint32_t minDist_ = 130, settle_ = 200, learning_ = 600, sqClamp_ = 0;
+
+  BiquadCascadeQ31x2<4> band_;                 // Lane A = IR, lane B = Red
+  MovingSumU32<BD_MAX_WINDOW> integrator_;
+  int32_t  bpPrev1_ = 0, bpPrev2_ = 0;
+  uint32_t integ_ = 0, integPrev1_ = 0, integPrev2_ = 0;
+
+  uint32_t seen_ = 0, learnMax_ = 0;
+  uint64_t learnSum_ = 0;
+  uint32_t spki_ = 0, npki_ = 0;
+
+  bool     haveCandidate_ = false;
+  uint32_t candidateIdx_ = 0, candidateValue_ = 0;
+  bool     haveLastBeat_ = false;
+  uint32_t lastBeatIdx_ = 0;
+  bool     haveNext_ = false;
+  uint32_t nextIndex_ = 0, lastIndex_ = 0;
+
+  uint32_t rrAvg_ = 0;
+  int      rrRejects_ = 0;
+
+  bool     started_ = false;
+  int32_t  offsetIr_ = 0, offsetRed_ = 0;
+  int32_t  dcIr_ = 0, dcRed_ = 0;
+  int64_t  acIrPow_ = 0, acRedPow_ = 0;
+
+  uint32_t winBeats_ = 0, winRrCount_ = 0, winRrSum_ = 0, winDiffCount_ = 0, prevRr_ = 0;
+  uint64_t winDiffSq_ = 0;
+  bool     havePrevRr_ = false;
+};
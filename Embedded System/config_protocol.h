@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+
+// ================================================================
+// RUNTIME CONFIG PROTOCOL (TLV)
+// ================================================================
+// Config characteristic (write):  [version u8] + any number of
+//                                 [tag u8][len u8][value, big-endian]
+// Config state characteristic (read, refreshed after every write and at
+// session start):                 [version u8][status u8] + one TLV per
+//                                 setting, plus the derived read-only tags.
+// A write is applied all-or-nothing: one bad entry rejects the whole write and
+// the state keeps the previous config with a non-zero status. While streaming
+// only LED brightness, packet pacing and contact pause may change; every other
+// tag must repeat the active value (so a host reconnecting to a held session
+// can resend its whole config), else the write is rejected as busy.
+
+const uint8_t CONFIG_VERSION = 1;
+
+const uint8_t CFG_SENSOR_RATE    = 0x01;   // u16 Hz: 50, 100, 200, 400, 800, 1000, 1600
+const uint8_t CFG_DECIMATION     = 0x02;   // u8, output rate = sensor rate / decimation
+const uint8_t CFG_PULSE_WIDTH    = 0x03;   // u16 us: 69, 118, 215, 411; 0 = longest the rate allows
+const uint8_t CFG_LED_BRIGHTNESS = 0x04;   // u8 LED current register (0xFF ~ 50 mA)
+const uint8_t CFG_BATCH_SIZE     = 0x05;   // u8 samples per v1 packet
+const uint8_t CFG_CHUNK_MS       = 0x06;   // u16 ms of samples per chunk (one seq number)
+const uint8_t CFG_PACING_MS      = 0x07;   // u16 minimum gap between packets, 0 = none
+const uint8_t CFG_POWER_MODE     = 0x08;   // u8 POWER_CONTINUOUS / POWER_BURST
+const uint8_t CFG_BURST_MS       = 0x09;   // u16 ms of samples collected per burst (burst mode)
+const uint8_t CFG_BUFFER_MS      = 0x0A;   // u16 ms of samples the ring may hold before it overflows
+const uint8_t CFG_STORE_FORWARD  = 0x0B;   // u8 1 = keep acquiring into flash while disconnected (v2 only)
+const uint8_t CFG_CONTACT_PAUSE  = 0x0C;   // u16 s of bad contact before transmission pauses, 0 = never
+const uint8_t CFG_OUTPUT_RATE    = 0x10;   // u16 Hz, read-only
+const uint8_t CFG_CHUNK_SAMPLES  = 0x11;   // u16, read-only
+
+const uint8_t CFG_STATUS_OK          = 0;
+const uint8_t CFG_STATUS_BAD_VERSION = 1;
+const uint8_t CFG_STATUS_BAD_TLV     = 2;  // Unknown tag, wrong length or truncated entry
+const uint8_t CFG_STATUS_BAD_VALUE   = 3;
+const uint8_t CFG_STATUS_BUSY        = 4;  // Would change a session setting while streaming
+
+const int CONFIG_MAX_SIZE = 64;            // Largest write accepted / state reported
+
+const uint8_t POWER_CONTINUOUS = 0;        // Stream every chunk as it completes, never sleep
+const uint8_t POWER_BURST      = 1;        // Sleep between FIFO interrupts, send burstMs at once
+
+struct StreamConfig {
+  uint16_t sensorRate;
+  uint8_t  decimation;
+  uint16_t pulseWidth;
+  uint8_t  ledBrightness;
+  uint8_t  batchSize;
+  uint16_t chunkMs;
+  uint16_t pacingMs;
+  uint8_t  powerMode;
+  uint16_t burstMs;
+  uint16_t bufferMs;
+  uint8_t  storeForward;
+  uint16_t contactPauseS;
+  int outputRate() const { return sensorRate / decimation; }
+};
+
+inline int configValueSize(uint8_t tag) {
+  switch (tag) {
+    case CFG_DECIMATION: case CFG_LED_BRIGHTNESS: case CFG_BATCH_SIZE: case CFG_POWER_MODE:
+    case CFG_STORE_FORWARD: return 1;
+    case CFG_SENSOR_RATE: case CFG_PULSE_WIDTH: case CFG_CHUNK_MS: case CFG_PACING_MS:
+    case CFG_BURST_MS: case CFG_BUFFER_MS: case CFG_CONTACT_PAUSE: return 2;
+    default: return 0;                     // Unknown or read-only
+  }
+}
+
+// Overlays the entries of a config write onto cfg. Range checks are left to the
+// caller; seenTags gets bit (1 << tag) for every tag present.
+inline uint8_t parseConfig(const uint8_t* data, int len, StreamConfig& cfg, uint32_t& seenTags) {
+  seenTags = 0;
+  if (len < 1 || data[0] != CONFIG_VERSION) return CFG_STATUS_BAD_VERSION;
+  for (int pos = 1; pos < len; ) {
+    if (pos + 2 > len) return CFG_STATUS_BAD_TLV;
+    uint8_t tag = data[pos], size = data[pos + 1];
+    if (size == 0 || size != configValueSize(tag) || pos + 2 + size > len) return CFG_STATUS_BAD_TLV;
+    const uint8_t* v = data + pos + 2;
+    uint16_t value = size == 1 ? v[0] : (uint16_t)((v[0] << 8) | v[1]);
+    switch (tag) {
+      case CFG_SENSOR_RATE:    cfg.sensorRate    = value;          break;
+      case CFG_DECIMATION:     cfg.decimation    = (uint8_t)value; break;
+      case CFG_PULSE_WIDTH:    cfg.pulseWidth    = value;          break;
+      case CFG_LED_BRIGHTNESS: cfg.ledBrightness = (uint8_t)value; break;
+      case CFG_BATCH_SIZE:     cfg.batchSize     = (uint8_t)value; break;
+      case CFG_CHUNK_MS:       cfg.chunkMs       = value;          break;
+      case CFG_PACING_MS:      cfg.pacingMs      = value;          break;
+      case CFG_POWER_MODE:     cfg.powerMode     = (uint8_t)value; break;
+      case CFG_BURST_MS:       cfg.burstMs       = value;          break;
+      case CFG_BUFFER_MS:      cfg.bufferMs      = value;          break;
+      case CFG_STORE_FORWARD:  cfg.storeForward  = (uint8_t)value; break;
+      case CFG_CONTACT_PAUSE:  cfg.contactPauseS = value;          break;
+    }
+    seenTags |= 1UL << tag;
+    pos += 2 + size;
+  }
+  return CFG_STATUS_OK;
+}
+
+inline int putConfigEntry(uint8_t* dst, uint8_t tag, uint16_t value, int size) {
+  dst[0] = tag;
+  dst[1] = (uint8_t)size;
+  if (size == 1) {
+    dst[2] = (uint8_t)value;
+  } else {
+    dst[2] = (uint8_t)(value >> 8);
+    dst[3] = (uint8_t)value;
+  }
+  return 2 + size;
+}
+
+// Serializes the active config for the state characteristic; returns its length
+inline int encodeConfigState(uint8_t* dst, const StreamConfig& cfg, uint8_t status, uint16_t chunkSamples) {
+  int len = 0;
+  dst[len++] = CONFIG_VERSION;
+  dst[len++] = status;
+  len += putConfigEntry(dst + len, CFG_SENSOR_RATE,    cfg.sensorRate,    2);
+  len += putConfigEntry(dst + len, CFG_DECIMATION,     cfg.decimation,    1);
+  len += putConfigEntry(dst + len, CFG_PULSE_WIDTH,    cfg.pulseWidth,    2);
+  len += putConfigEntry(dst + len, CFG_LED_BRIGHTNESS, cfg.ledBrightness, 1);
+  len += putConfigEntry(dst + len, CFG_BATCH_SIZE,     cfg.batchSize,     1);
+  len += putConfigEntry(dst + len, CFG_CHUNK_MS,       cfg.chunkMs,       2);
+  len += putConfigEntry(dst + len, CFG_PACING_MS,      cfg.pacingMs,      2);
+  len += putConfigEntry(dst + len, CFG_POWER_MODE,     cfg.powerMode,     1);
+  len += putConfigEntry(dst + len, CFG_BURST_MS,       cfg.burstMs,       2);
+  len += putConfigEntry(dst + len, CFG_BUFFER_MS,      cfg.bufferMs,      2);
+  len += putConfigEntry(dst + len, CFG_STORE_FORWARD,  cfg.storeForward,  1);
+  len += putConfigEntry(dst + len, CFG_CONTACT_PAUSE,  cfg.contactPauseS, 2);
+  len += putConfigEntry(dst + len, CFG_OUTPUT_RATE,    (uint16_t)cfg.outputRate(), 2);
+  len += putConfigEntry(dst + len, CFG_CHUNK_SAMPLES,  chunkSamples,      2);
+  return len;
+}
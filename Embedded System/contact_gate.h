@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+// ================================================================
+// ON-DEVICE CONTACT GATE
+// ================================================================
+// The raw-signal part of the host's signal-quality index (signal_quality.py),
+// cheap enough for every output sample: off-finger the IR reading drops to
+// ambient / LED crosstalk level, and pressed hard or in bright light a channel
+// clips at the 18-bit top. After holdSamples bad samples in a row the gate
+// closes and the caller stops storing samples (nothing is sent, the radio
+// stays idle); it opens again after resumeSamples good ones. holdSamples = 0
+// disables it.
+
+struct ContactGate {
+  uint32_t minIr = 0, clipLevel = 0;
+  uint32_t holdSamples = 0, resumeSamples = 0;
+  uint32_t run = 0;              // Bad samples in a row while open, good ones while closed
+  bool     closed = false;
+
+  void configure(uint32_t minIr_, uint32_t clipLevel_, uint32_t hold, uint32_t resume) {
+    minIr = minIr_;
+    clipLevel = clipLevel_;
+    holdSamples = hold;
+    resumeSamples = resume;
+    if (hold == 0) reset();
+  }
+
+  void reset() {
+    run = 0;
+    closed = false;
+  }
+
+  // Returns true while samples should be dropped
+  bool update(uint32_t ir, uint32_t red) {
+    if (holdSamples == 0) return false;
+    bool bad = ir < minIr || ir >= clipLevel || red >= clipLevel;
+    if (bad == closed) {
+      run = 0;                   // Still in the state we are in
+    } else if (++run >= (closed ? resumeSamples : holdSamples)) {
+      closed = !closed;
+      run = 0;
+    }
+    return closed;
+  }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// ================================================================
+// CYCLE COUNTER (DWT CYCCNT)
+// ================================================================
+// Single-cycle reads of the Cortex-M3/M4/M7 debug cycle counter – cheap enough
+// to leave on in production builds. Other cores report 0 so callers can fall
+// back to micros().
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define CYCLE_COUNTER_AVAILABLE 1
+#else
+#define CYCLE_COUNTER_AVAILABLE 0
+#endif
+
+inline void cycleCounterEnable() {
+#if CYCLE_COUNTER_AVAILABLE
+  volatile uint32_t* DEMCR      = (volatile uint32_t*)0xE000EDFC;
+  volatile uint32_t* DWT_CTRL   = (volatile uint32_t*)0xE0001000;
+  volatile uint32_t* DWT_CYCCNT = (volatile uint32_t*)0xE0001004;
+  *DEMCR |= (1UL << 24);               // TRCENA
+  *DWT_CYCCNT = 0;
+  *DWT_CTRL |= 1UL;                    // CYCCNTENA
+#endif
+}
+
+inline uint32_t cycleCount() {
+#if CYCLE_COUNTER_AVAILABLE
+  return *(volatile uint32_t*)0xE0001004;
+#else
+  return 0;
+#endif
+}
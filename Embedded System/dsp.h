@@ -0,0 +1,294 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+// ================================================================
+// FIXED-POINT DSP KERNELS (TWO-LANE: IR + RED)
+// ================================================================
+// Every kernel filters IR and Red in the same pass, so each coefficient is
+// loaded once and applied to both lanes. On Cortex-M4F (nRF52840) the inner
+// loops use the DSP extension:
+//   SMLAD        dual 16 x 16 MAC          – Q15 biquad (two taps per instruction)
+//   SMLAWB/SMLAWT 32 x 16 MAC, either half  – FIR with packed Q15 coefficient pairs
+//   SMLAL        32 x 32 -> 64 MAC          – Q31 biquad (compiler emits it for int64 +=)
+// Other boards get bit-exact scalar fallbacks of the same operations.
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define DSP_USE_SIMD 1
+#else
+#define DSP_USE_SIMD 0
+#endif
+
+// ---------------- SIMD primitives ----------------
+
+inline uint32_t dspPack16(int32_t lo, int32_t hi) {
+  return ((uint32_t)(uint16_t)lo) | ((uint32_t)(uint16_t)hi << 16);
+}
+
+// acc + lo(x)*lo(y) + hi(x)*hi(y)
+inline int32_t dspSmlad(uint32_t x, uint32_t y, int32_t acc) {
+#if DSP_USE_SIMD
+  int32_t r;
+  __asm__ ("smlad %0, %1, %2, %3" : "=r"(r) : "r"(x), "r"(y), "r"(acc));
+  return r;
+#else
+  return acc + (int16_t)x * (int16_t)y + (int16_t)(x >> 16) * (int16_t)(y >> 16);
+#endif
+}
+
+// acc + (x * lo(h)) >> 16
+inline int32_t dspSmlawb(int32_t x, uint32_t h, int32_t acc) {
+#if DSP_USE_SIMD
+  int32_t r;
+  __asm__ ("smlawb %0, %1, %2, %3" : "=r"(r) : "r"(x), "r"(h), "r"(acc));
+  return r;
+#else
+  return acc + (int32_t)(((int64_t)x * (int16_t)h) >> 16);
+#endif
+}
+
+// acc + (x * hi(h)) >> 16
+inline int32_t dspSmlawt(int32_t x, uint32_t h, int32_t acc) {
+#if DSP_USE_SIMD
+  int32_t r;
+  __asm__ ("smlawt %0, %1, %2, %3" : "=r"(r) : "r"(x), "r"(h), "r"(acc));
+  return r;
+#else
+  return acc + (int32_t)(((int64_t)x * (int16_t)(h >> 16)) >> 16);
+#endif
+}
+
+inline int16_t dspSat16(int32_t x) {
+  return x > 32767 ? 32767 : (x < -32768 ? -32768 : (int16_t)x);
+}
+
+// ---------------- Biquad design (once, floating point) ----------------
+
+struct BiquadCoeffs {
+  double b0, b1, b2, a1, a2;     // Normalized so a0 = 1
+
+  // RBJ cookbook sections; Q = 0.5412 and 1.3066 cascade to 4th-order Butterworth
+  static BiquadCoeffs lowpass(float fc, float fs, float Q) {
+    double w0 = 2.0 * M_PI * fc / fs, c = cos(w0), alpha = sin(w0) / (2.0 * Q), a0 = 1 + alpha;
+    return { (1 - c) / 2 / a0, (1 - c) / a0, (1 - c) / 2 / a0, -2 * c / a0, (1 - alpha) / a0 };
+  }
+
+  static BiquadCoeffs highpass(float fc, float fs, float Q) {
+    double w0 = 2.0 * M_PI * fc / fs, c = cos(w0), alpha = sin(w0) / (2.0 * Q), a0 = 1 + alpha;
+    return { (1 + c) / 2 / a0, -(1 + c) / a0, (1 + c) / 2 / a0, -2 * c / a0, (1 - alpha) / a0 };
+  }
+};
+
+// ---------------- Q31 biquad cascade, 64-bit accumulators ----------------
+// Q30 coefficients (|a1| < 2) and 64-bit accumulators keep low-cutoff high-pass
+// sections (0.7 Hz at 1 kHz puts the poles ~0.004 from the unit circle) stable,
+// which Q15 coefficients cannot.
+
+template<int STAGES>
+class BiquadCascadeQ31x2 {
+public:
+  void setStage(int i, const BiquadCoeffs& c) {
+    const double q = (double)(1L << 30);
+    coeff_[i][0] = (int32_t)lround(c.b0 * q);
+    coeff_[i][1] = (int32_t)lround(c.b1 * q);
+    coeff_[i][2] = (int32_t)lround(c.b2 * q);
+    coeff_[i][3] = (int32_t)lround(-c.a1 * q);   // Stored negated: every term is a MAC
+    coeff_[i][4] = (int32_t)lround(-c.a2 * q);
+  }
+
+  void reset() {
+    for (int i = 0; i < STAGES; i++)
+      for (int l = 0; l < 2; l++)
+        for (int k = 0; k < 4; k++) state_[i][l][k] = 0;
+  }
+
+  // One sample per lane, in place
+  void step(int32_t& a, int32_t& b) {
+    for (int i = 0; i < STAGES; i++) {
+      const int32_t* c = coeff_[i];
+      a = section(c, state_[i][0], a);
+      b = section(c, state_[i][1], b);
+    }
+  }
+
+  // Stage-major block processing keeps one stage's coefficients in registers
+  void processBlock(int32_t* a, int32_t* b, int n) {
+    for (int i = 0; i < STAGES; i++) {
+      const int32_t* c = coeff_[i];
+      for (int k = 0; k < n; k++) {
+        a[k] = section(c, state_[i][0], a[k]);
+        b[k] = section(c, state_[i][1], b[k]);
+      }
+    }
+  }
+
+private:
+  static inline int32_t section(const int32_t* c, int32_t* s, int32_t x) {
+    // s = { x[n-1], x[n-2], y[n-1], y[n-2] }
+    int64_t acc = 1LL << 29;                    // Round to nearest
+    acc += (int64_t)c[0] * x;
+    acc += (int64_t)c[1] * s[0];
+    acc += (int64_t)c[2] * s[1];
+    acc += (int64_t)c[3] * s[2];
+    acc += (int64_t)c[4] * s[3];
+    int32_t y = (int32_t)(acc >> 30);
+    s[1] = s[0]; s[0] = x;
+    s[3] = s[2]; s[2] = y;
+    return y;
+  }
+
+  int32_t coeff_[STAGES][5];
+  int32_t state_[STAGES][2][4];
+};
+
+// ---------------- Q15 biquad cascade (SMLAD) ----------------
+// For small-signal, higher-cutoff sections (smoothing, post-decimation low-pass).
+// Coefficients are Q14 so |a1| up to 2 fits; states are packed halfword pairs so
+// each SMLAD does two taps.
+
+template<int STAGES>
+class BiquadCascadeQ15x2 {
+public:
+  void setStage(int i, const BiquadCoeffs& c) {
+    const double q = 16384.0;
+    b0_[i]  = (int16_t)lround(c.b0 * q);
+    bPair_[i] = dspPack16((int32_t)lround(c.b1 * q),  (int32_t)lround(c.b2 * q));
+    aPair_[i] = dspPack16((int32_t)lround(-c.a1 * q), (int32_t)lround(-c.a2 * q));
+  }
+
+  void reset() {
+    for (int i = 0; i < STAGES; i++)
+      for (int l = 0; l < 2; l++) xs_[i][l] = ys_[i][l] = 0;
+  }
+
+  void step(int16_t& a, int16_t& b) {
+    for (int i = 0; i < STAGES; i++) {
+      a = section(i, 0, a);
+      b = section(i, 1, b);
+    }
+  }
+
+private:
+  inline int16_t section(int i, int lane, int16_t x) {
+    int32_t acc = b0_[i] * x + (1 << 13);
+    acc = dspSmlad(xs_[i][lane], bPair_[i], acc);
+    acc = dspSmlad(ys_[i][lane], aPair_[i], acc);
+    int16_t y = dspSat16(acc >> 14);
+    xs_[i][lane] = (xs_[i][lane] << 16) | (uint16_t)x;   // lo = x[n-1], hi = x[n-2]
+    ys_[i][lane] = (ys_[i][lane] << 16) | (uint16_t)y;
+    return y;
+  }
+
+  int16_t  b0_[STAGES];
+  uint32_t bPair_[STAGES], aPair_[STAGES];
+  uint32_t xs_[STAGES][2], ys_[STAGES][2];
+};
+
+// ---------------- FIR anti-alias decimator (Q15 taps, Q31 data) ----------------
+// Output is computed only on every factor-th input, which costs TAPS / factor
+// MACs per input sample – the same work as a polyphase decomposition, without
+// splitting the taps. Delay lines are stored twice so the MAC loop never wraps.
+
+template<int TAPS>
+class FirDecimatorQ15x2 {
+  static_assert(TAPS % 2 == 0, "FIR tap count must be even (taps are packed in pairs)");
+
+public:
+  // Hamming-windowed sinc with cutoff = passband / factor (fraction of Nyquist)
+  void design(int factor, float passband = 0.8f) {
+    factor_ = factor < 1 ? 1 : factor;
+    double fc = passband / (2.0 * factor_);      // Cycles per input sample
+    double h[TAPS], sum = 0;
+    for (int n = 0; n < TAPS; n++) {
+      double m = n - (TAPS - 1) / 2.0;
+      double sinc = m == 0 ? 2 * fc : sin(2 * M_PI * fc * m) / (M_PI * m);
+      h[n] = sinc * (0.54 - 0.46 * cos(2 * M_PI * n / (TAPS - 1)));
+      sum += h[n];
+    }
+    for (int n = 0; n < TAPS; n += 2) {
+      taps_[n / 2] = dspPack16((int32_t)lround(h[n] / sum * 32767.0),
+                               (int32_t)lround(h[n + 1] / sum * 32767.0));
+    }
+    reset();
+  }
+
+  void reset() {
+    for (int n = 0; n < 2 * TAPS; n++) histA_[n] = histB_[n] = 0;
+    pos_ = 0;
+    phase_ = 0;
+  }
+
+  // Fills the delay lines with one value, so a stream that starts at a DC level
+  // does not ramp up from zero through the whole filter length
+  void prime(int32_t a, int32_t b) {
+    for (int n = 0; n < 2 * TAPS; n++) {
+      histA_[n] = a;
+      histB_[n] = b;
+    }
+  }
+
+  // Group delay of the linear-phase filter, in input samples
+  static constexpr float delay() { return (TAPS - 1) / 2.0f; }
+
+  // Returns true when an output sample is ready. Keep |input| < 2^30.
+  bool push(int32_t a, int32_t b, int32_t& outA, int32_t& outB) {
+    histA_[pos_] = histA_[pos_ + TAPS] = a;
+    histB_[pos_] = histB_[pos_ + TAPS] = b;
+    if (++pos_ == TAPS) pos_ = 0;
+    if (++phase_ < factor_) return false;
+    phase_ = 0;
+
+    // Oldest sample first, paired with h[0]
+    const int32_t* xa = histA_ + pos_;
+    const int32_t* xb = histB_ + pos_;
+    int32_t accA = 0, accB = 0;
+    for (int k = 0; k < TAPS / 2; k++) {
+      uint32_t h2 = taps_[k];
+      accA = dspSmlawb(xa[2 * k],     h2, accA);
+      accA = dspSmlawt(xa[2 * k + 1], h2, accA);
+      accB = dspSmlawb(xb[2 * k],     h2, accB);
+      accB = dspSmlawt(xb[2 * k + 1], h2, accB);
+    }
+    outA = accA << 1;                            // (x * Q15) >> 16 is half scale
+    outB = accB << 1;
+    return true;
+  }
+
+private:
+  uint32_t taps_[TAPS / 2];
+  int32_t  histA_[2 * TAPS], histB_[2 * TAPS];
+  int      pos_ = 0, phase_ = 0, factor_ = 1;
+};
+
+// ---------------- Moving sum (integrator) ----------------
+
+template<int MAXN>
+class MovingSumU32 {
+public:
+  void begin(int n) {
+    n_ = n < 1 ? 1 : (n > MAXN ? MAXN : n);
+    reset();
+  }
+
+  void reset() {
+    for (int i = 0; i < MAXN; i++) buf_[i] = 0;
+    sum_ = 0;
+    pos_ = 0;
+  }
+
+  int length() const { return n_; }
+
+  // Callers keep values <= UINT32_MAX / length() so the sum cannot overflow
+  uint32_t push(uint32_t v) {
+    sum_ += v - buf_[pos_];
+    buf_[pos_] = v;
+    if (++pos_ >= n_) pos_ = 0;
+    return sum_;
+  }
+
+private:
+  uint32_t buf_[MAXN];
+  uint32_t sum_ = 0;
+  int      n_ = 1, pos_ = 0;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config_protocol.h"
+#include "ring_buffer.h"
+#include "wire_format.h"
+
+// ================================================================
+// COMPILE-TIME FIRMWARE PROFILES
+// ================================================================
+// A profile bundles the build-time tuning: the session defaults (the host can
+// still override those per session over the config characteristic, see
+// config_protocol.h) and what is fixed at build time – the ring size, the
+// highest output rate and the debug level. main.cpp picks one with
+// FIRMWARE_PROFILE; ProfileInvariants<> checks each profile at compile time,
+// so a bad edit fails the build instead of a session.
+
+const int DEBUG_NONE     = 0;
+const int DEBUG_INFO     = 1;
+const int DEBUG_VERBOSE  = 2;
+
+constexpr bool isPowerOfTwo(size_t n) { return n > 0 && (n & (n - 1)) == 0; }
+
+// Chunk length in samples: whole v1 packets, at least one
+constexpr int roundToBatch(int rawChunk, int batchSize) {
+  return rawChunk / batchSize * batchSize < batchSize ? batchSize : rawChunk / batchSize * batchSize;
+}
+
+// Sensor rates the MAX30102 runs with both LEDs (see maxPulseWidthFor())
+constexpr bool isSensorRate(int rate) {
+  return rate == 50 || rate == 100 || rate == 200 || rate == 400 ||
+         rate == 800 || rate == 1000 || rate == 1600;
+}
+
+struct FirmwareProfile {
+  int      sampleRate;              // Hz – default output rate; the 'R' command changes it per session
+  int      decimation;              // Default on-device decimation (sensor runs at sampleRate x this)
+  int      maxOutputRate;           // Hz – highest output rate 'R' accepts (sizes the ring buffer)
+  int      bufferHeadroomSeconds;   // Ring headroom at maxOutputRate (prevents overflow during BLE delays)
+  float    chunkSeconds;            // How much data is sent in one burst (latency vs. overhead trade-off)
+  int      pacingMs;                // Optional minimum gap between BLE packets (never blocks); 0 = flow control only
+  int      batchSize;               // Samples per v1 BLE packet (chunks are rounded to a multiple); v2 fills the MTU
+  uint8_t  ledBrightness;           // LED current register (0xFF ~ 50 mA) – reduce if the sensor gets hot
+  uint8_t  powerMode;               // POWER_BURST: sleep between FIFO interrupts, send in bursts
+  float    burstSeconds;            // Burst mode: seconds of samples collected before each burst
+  bool     storeAndForward;         // Keep acquiring into flash while disconnected, backfill on reconnect
+  int      contactPauseSeconds;     // Stop sending after this long off-finger / saturated; 0 = always send
+  int      debugLevel;              // DEBUG_NONE in production: debug code is not compiled in at all
+
+  constexpr int sensorRate() const   { return sampleRate * decimation; }
+  constexpr int bufferSize() const   { return (int)nextPowerOfTwo((size_t)maxOutputRate * bufferHeadroomSeconds); }
+  constexpr int packetSize() const   { return v1PacketSize(batchSize); }
+  constexpr int chunkSize() const    { return roundToBatch((int)(sampleRate * chunkSeconds), batchSize); }
+  constexpr int burstSamples() const { return (int)(sampleRate * burstSeconds); }
+  constexpr uint16_t chunkMs() const { return (uint16_t)(chunkSeconds * 1000 + 0.5f); }
+  constexpr uint16_t burstMs() const { return (uint16_t)(burstSeconds * 1000 + 0.5f); }
+};
+
+// 400 Hz at the full 18-bit / 411 us pulse, short chunks for low latency
+constexpr FirmwareProfile PROFILE_HIGH_FIDELITY = {
+  400, 1, 400, 5, 0.10f, 0, 16, 0xF1, POWER_CONTINUOUS, 3.0f, false, 0, DEBUG_NONE
+};
+
+// The long-standing defaults: 200 Hz, 200 ms chunks, continuous streaming
+constexpr FirmwareProfile PROFILE_BALANCED = {
+  200, 1, 400, 5, 0.20f, 0, 16, 0xF1, POWER_CONTINUOUS, 3.0f, false, 0, DEBUG_NONE
+};
+
+// 50 Hz wearable: half LED current, burst mode, pauses off-finger
+constexpr FirmwareProfile PROFILE_LOW_POWER = {
+  50, 1, 400, 5, 0.20f, 0, 16, 0x7F, POWER_BURST, 3.0f, false, 10, DEBUG_NONE
+};
+
+// Compile-time checks of a profile; instantiated for every profile above (and
+// for the active one in main.cpp, next to the link limits it must also fit)
+template<const FirmwareProfile& P>
+struct ProfileInvariants {
+  static_assert(isSensorRate(P.sensorRate()), "profile sensor rate is not a MAX30102 rate");
+  static_assert(P.sampleRate <= P.maxOutputRate, "default output rate above maxOutputRate");
+  static_assert(P.batchSize >= 1, "batchSize must be at least one sample");
+  static_assert(P.chunkSize() % P.batchSize == 0, "chunk must be a whole number of v1 packets");
+  static_assert(isPowerOfTwo(P.bufferSize()), "ring size must be a power of two (masked indexing)");
+  static_assert(P.sampleRate * P.bufferHeadroomSeconds <= P.bufferSize(), "default buffer does not fit the ring");
+  static_assert(P.chunkMs() >= 20 && P.chunkMs() <= 1000, "chunkSeconds outside 0.02–1 s (applyConfig range)");
+  static_assert(P.powerMode != POWER_BURST ||
+                (P.burstSamples() >= P.batchSize &&
+                 P.burstSamples() <= P.sampleRate * P.bufferHeadroomSeconds * 3 / 4),
+                "burst must fit 3/4 of the default buffer");
+  static_assert(P.contactPauseSeconds >= 0 && P.contactPauseSeconds <= 3600, "contactPauseSeconds out of range");
+  static_assert(P.debugLevel >= DEBUG_NONE && P.debugLevel <= DEBUG_VERBOSE, "unknown debug level");
+  static constexpr bool ok = true;
+};
+
+static_assert(ProfileInvariants<PROFILE_HIGH_FIDELITY>::ok, "high-fidelity profile");
+static_assert(ProfileInvariants<PROFILE_BALANCED>::ok, "balanced profile");
+static_assert(ProfileInvariants<PROFILE_LOW_POWER>::ok, "low-power profile");
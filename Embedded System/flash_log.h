@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wire_format.h"
+
+#if defined(ARDUINO_ARCH_MBED)
+#include <FlashIAP.h>
+#define FLASH_LOG_AVAILABLE 1
+#else
+#define FLASH_LOG_AVAILABLE 0
+#endif
+
+// ================================================================
+// LOG-STRUCTURED SAMPLE RING IN INTERNAL FLASH
+// ================================================================
+// Store-and-forward while the central is away: the ring buffer is flushed into
+// fixed 256-byte blocks of consecutive samples (one absolute index each), written
+// round-robin over the top of the nRF52840's internal flash. Blocks are
+// programmed append-only and a sector is erased just before its first block is
+// written; when the log is full, the oldest sector is dropped. The read/write
+// positions live in RAM – the log only has to survive a dropped link, not a reset.
+//
+// Erasing a 4 KB page stalls the CPU for ~85 ms, so the FIFO must be able to
+// hold that long (see FLASH_ERASE_MS in main.cpp).
+
+const uint16_t FLASH_BLOCK_MAGIC   = 0x5053; // "PS"
+const int      FLASH_BLOCK_BYTES   = 256;
+const int      FLASH_BLOCK_SAMPLES = (FLASH_BLOCK_BYTES - 8) / (int)sizeof(PackedSample);
+
+struct FlashBlock {
+  uint16_t     magic;
+  uint8_t      count;           // Valid samples (consecutive indices)
+  uint8_t      reserved;
+  uint32_t     firstIndex;      // Absolute index of samples[0]
+  PackedSample samples[FLASH_BLOCK_SAMPLES];
+  uint8_t      pad[FLASH_BLOCK_BYTES - 8 - FLASH_BLOCK_SAMPLES * sizeof(PackedSample)];
+};
+static_assert(sizeof(FlashBlock) == FLASH_BLOCK_BYTES, "FlashBlock must be one program unit multiple");
+
+// Packer source over one block (see wire_format.h)
+struct BlockSource {
+  const PackedSample* samples;
+  const PackedSample& peek(size_t i) const { return samples[i]; }
+};
+
+class FlashLog {
+public:
+  // Reserves the top `bytes` of flash; false if flash access is unavailable
+  bool begin(uint32_t bytes) {
+#if FLASH_LOG_AVAILABLE
+    if (flash_.init() != 0) return false;
+    uint32_t end = flash_.get_flash_start() + flash_.get_flash_size();
+    base_ = end - bytes;
+    sector_ = flash_.get_sector_size(base_);
+    if (sector_ == 0 || sector_ % FLASH_BLOCK_BYTES != 0 || bytes % sector_ != 0) return false;
+#ifdef FLASHIAP_APP_ROM_END_ADDR
+    if (base_ < (uint32_t)FLASHIAP_APP_ROM_END_ADDR) return false;     // Would overwrite the sketch
+#endif
+    capacity_ = bytes / FLASH_BLOCK_BYTES;
+    blocksPerSector_ = sector_ / FLASH_BLOCK_BYTES;
+    ready_ = true;
+    clear();
+#else
+    (void)bytes;
+#endif
+    return ready_;
+  }
+
+  bool ready() const { return ready_; }
+
+  void clear() {
+    head_ = tail_ = 0;
+  }
+
+  uint32_t size() const { return head_ - tail_; }
+  bool empty() const { return head_ == tail_; }
+
+  // Appends one block, overwriting the oldest sector when the log is full
+  bool append(const FlashBlock& block) {
+    if (!ready_) return false;
+    if (head_ % blocksPerSector_ == 0) {
+      if (head_ - tail_ > capacity_ - blocksPerSector_) {
+        tail_ = head_ - capacity_ + blocksPerSector_;
+      }
+      if (!eraseSector(slotAddress(head_))) return false;
+    }
+    if (!program(slotAddress(head_), &block)) return false;
+    head_++;
+    return true;
+  }
+
+  bool readOldest(FlashBlock& block) {
+    if (!ready_ || empty()) return false;
+    if (!read(slotAddress(tail_), &block)) return false;
+    return block.magic == FLASH_BLOCK_MAGIC && block.count <= FLASH_BLOCK_SAMPLES;
+  }
+
+  void dropOldest() {
+    if (!empty()) tail_++;
+  }
+
+private:
+  uint32_t slotAddress(uint32_t n) const { return base_ + (n % capacity_) * FLASH_BLOCK_BYTES; }
+
+#if FLASH_LOG_AVAILABLE
+  bool eraseSector(uint32_t addr)                  { return flash_.erase(addr, sector_) == 0; }
+  bool program(uint32_t addr, const FlashBlock* b) { return flash_.program(b, addr, FLASH_BLOCK_BYTES) == 0; }
+  bool read(uint32_t addr, FlashBlock* b)          { return flash_.read(b, addr, FLASH_BLOCK_BYTES) == 0; }
+
+  mbed::FlashIAP flash_;
+#else
+  bool eraseSector(uint32_t)                       { return false; }
+  bool program(uint32_t, const FlashBlock*)        { return false; }
+  bool read(uint32_t, FlashBlock*)                 { return false; }
+#endif
+
+  bool     ready_ = false;
+  uint32_t base_ = 0, sector_ = 0, capacity_ = 1, blocksPerSector_ = 1;
+  uint32_t head_ = 0, tail_ = 0;                   // Free-running block counters
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdint.h>
+#include "wire_format.h"
+
+// ================================================================
+// HOT-PATH INSTRUMENTATION
+// ================================================================
+// A few adds and compares per loop pass, timed with the DWT cycle counter (or
+// micros() where there is none), so it stays on in production builds. The stats
+// characteristic (read / notify, once per STATS_PERIOD_MS) carries:
+//   [version u8][window_ms u16]
+//   [loops u32][loop_avg_us u16][loop_max_us u16]             – window
+//   [drains u16][drain_avg_samples x10 u16][drain_max_samples u8] – window
+//   [ring_now u16][ring_high_water u16]
+//   [ring_overflows u32][fifo_overflows u32]
+//   [notify_sent u32][notify_failed u32]
+//   [tx_blocked u32][tx_time_ms u32]                           – session
+//   [sleep_ms u32]                                             – session
+//   [contact_paused u32]                                       – session
+//   [task_busy_permille u16][task_stack_used u16] x TASK_COUNT – window / session
+//   [acq_wake_max_us u16]                                      – window
+// "Window" values cover the time since the previous report, everything else the
+// whole streaming session. tx_time_ms is the time spent inside writeValue()
+// (the only place the loop can still stall), tx_blocked the writes slower than
+// TX_BLOCKED_US. sleep_ms is the time the CPU spent in WFE (burst mode), the
+// best on-device proxy for current draw. contact_paused counts the output
+// samples dropped while the contact gate was closed (contact_gate.h). The task
+// block is filled by the threaded build (task_split.h) and zero otherwise: the
+// share of the window each thread spent running, its stack high water in bytes,
+// and the worst FIFO interrupt -> acquisition thread wake-up latency.
+
+const uint8_t STATS_VERSION     = 1;
+const int     STATS_PACKET_SIZE = 66;
+
+// Threads of the RTOS_TASKS build, in stats order
+enum TaskId { TASK_ACQUISITION, TASK_DSP, TASK_BLE, TASK_COUNT };
+
+struct HotPathStats {
+  // Window
+  uint32_t loops, loopTicksSum, loopTicksMax;
+  uint32_t drains, drainSamples, drainMax;
+  // Session
+  uint32_t ringHighWater, ringOverflows;
+  uint32_t notifySent, notifyFailed, txBlocked;
+  uint32_t contactPaused;
+  uint64_t txTimeUs, sleepUs;
+  // Per task (window: busy ticks, wake latency; session: stack high water)
+  uint32_t taskBusyTicks[TASK_COUNT];
+  uint32_t taskStackUsed[TASK_COUNT];
+  uint32_t acqWakeMaxUs;
+
+  void reset() { *this = HotPathStats(); }
+
+  void resetWindow() {
+    loops = loopTicksSum = loopTicksMax = 0;
+    drains = drainSamples = drainMax = 0;
+    for (int t = 0; t < TASK_COUNT; t++) taskBusyTicks[t] = 0;
+    acqWakeMaxUs = 0;
+  }
+
+  void recordTask(int task, uint32_t ticks) { taskBusyTicks[task] += ticks; }
+
+  void recordWake(uint32_t us) {
+    if (us > acqWakeMaxUs) acqWakeMaxUs = us;
+  }
+
+  void recordLoop(uint32_t ticks) {
+    loops++;
+    loopTicksSum += ticks;
+    if (ticks > loopTicksMax) loopTicksMax = ticks;
+  }
+
+  void recordDrain(uint32_t samples, uint32_t ringFill) {
+    drains++;
+    drainSamples += samples;
+    if (samples > drainMax) drainMax = samples;
+    if (ringFill > ringHighWater) ringHighWater = ringFill;
+  }
+
+  void recordWrite(bool ok, uint32_t us, bool blocked) {
+    if (ok) notifySent++;
+    else    notifyFailed++;
+    if (blocked) txBlocked++;
+    txTimeUs += us;
+  }
+};
+
+inline uint16_t statsSat16(uint32_t v) { return v > 0xFFFF ? 0xFFFF : (uint16_t)v; }
+
+// Serializes the report and closes the window; ticksPerUs converts loop timing
+inline int encodeStats(uint8_t* dst, HotPathStats& s, uint32_t windowMs, uint32_t ticksPerUs,
+                       uint32_t ringNow, uint32_t fifoOverflows) {
+  uint32_t loopAvg = s.loops ? s.loopTicksSum / s.loops / ticksPerUs : 0;
+  uint32_t drainAvgX10 = s.drains ? s.drainSamples * 10 / s.drains : 0;
+  dst[0] = STATS_VERSION;
+  putBigEndian16(dst + 1,  statsSat16(windowMs));
+  putBigEndian32(dst + 3,  s.loops);
+  putBigEndian16(dst + 7,  statsSat16(loopAvg));
+  putBigEndian16(dst + 9,  statsSat16(s.loopTicksMax / ticksPerUs));
+  putBigEndian16(dst + 11, statsSat16(s.drains));
+  putBigEndian16(dst + 13, statsSat16(drainAvgX10));
+  dst[15] = s.drainMax > 0xFF ? 0xFF : (uint8_t)s.drainMax;
+  putBigEndian16(dst + 16, statsSat16(ringNow));
+  putBigEndian16(dst + 18, statsSat16(s.ringHighWater));
+  putBigEndian32(dst + 20, s.ringOverflows);
+  putBigEndian32(dst + 24, fifoOverflows);
+  putBigEndian32(dst + 28, s.notifySent);
+  putBigEndian32(dst + 32, s.notifyFailed);
+  putBigEndian32(dst + 36, s.txBlocked);
+  putBigEndian32(dst + 40, (uint32_t)(s.txTimeUs / 1000));
+  putBigEndian32(dst + 44, (uint32_t)(s.sleepUs / 1000));
+  putBigEndian32(dst + 48, s.contactPaused);
+  for (int t = 0; t < TASK_COUNT; t++) {
+    uint32_t busyUs = s.taskBusyTicks[t] / ticksPerUs;
+    putBigEndian16(dst + 52 + 4 * t, statsSat16(windowMs ? busyUs / windowMs : 0));   // us per ms = permille
+    putBigEndian16(dst + 54 + 4 * t, statsSat16(s.taskStackUsed[t]));
+  }
+  putBigEndian16(dst + 64, statsSat16(s.acqWakeMaxUs));
+  s.resetWindow();
+  return STATS_PACKET_SIZE;
+}
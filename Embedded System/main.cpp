@@ -1,45 +1,141 @@
 #include <Wire.h>
 #include <MAX30105.h>
 #include <ArduinoBLE.h>
+#include <utility/ATT.h>
+#include <utility/HCI.h>
+#include "ring_buffer.h"
+#include "wire_format.h"
+#include "beat_detector.h"
+#include "dsp.h"
+#include "cycle_counter.h"
+#include "config_protocol.h"
+#include "hot_path_stats.h"
+#include "flash_log.h"
+#include "contact_gate.h"
+#include "firmware_profile.h"
+#include "task_split.h"
 
 // ================================================================
-// USER-CONFIGURABLE CONSTANTS
+// BUILD PROFILE
 // ================================================================
-// Tune these for performance vs. memory vs. BLE stability
-const int SAMPLE_RATE            = 200;   // Hz – higher = more detail, but harder on CPU/BLE
-const int BUFFER_HEADROOM_SECONDS = 5;    // Seconds of buffer headroom (prevents overflow during BLE delays)
-const float CHUNK_SECONDS        = 0.20f; // How much data is sent in one burst (latency vs. overhead trade-off)
-const int PACKET_PACING_MS       = 3;     // Small delay between BLE packets – critical for reliability
-const int BATCH_SIZE             = 16;    // Samples per BLE packet (must divide CHUNK_SIZE evenly)
+// Tuning lives in the profiles of firmware_profile.h (high fidelity 400 Hz,
+// balanced 200 Hz, low power 50 Hz); pick one here or with
+// -DFIRMWARE_PROFILE=PROFILE_LOW_POWER. Most values are only the defaults of a
+// session – the host can override them over the config characteristic without
+// reflashing (see config_protocol.h); the ring size and debug level are fixed.
+#ifndef FIRMWARE_PROFILE
+#define FIRMWARE_PROFILE PROFILE_BALANCED
+#endif
+constexpr const FirmwareProfile& PROFILE = FIRMWARE_PROFILE;
+static_assert(ProfileInvariants<PROFILE>::ok, "active firmware profile");
+
+constexpr int      SAMPLE_RATE             = PROFILE.sampleRate;
+constexpr int      DECIMATION_FACTOR       = PROFILE.decimation;
+constexpr int      MAX_OUTPUT_RATE         = PROFILE.maxOutputRate;
+constexpr int      BUFFER_HEADROOM_SECONDS = PROFILE.bufferHeadroomSeconds;
+constexpr int      BATCH_SIZE              = PROFILE.batchSize;
+constexpr int      DEBUG_LEVEL             = PROFILE.debugLevel;
 
 // ================================================================
 // DERIVED CONSTANTS (do NOT edit)
 // ================================================================
-const int BUFFER_SIZE   = SAMPLE_RATE * BUFFER_HEADROOM_SECONDS;
-const int RAW_CHUNK_SIZE = (int)(SAMPLE_RATE * CHUNK_SECONDS + 0.5f);
-const int CHUNK_SIZE     = (RAW_CHUNK_SIZE / BATCH_SIZE) * BATCH_SIZE; // Rounded to multiple of BATCH_SIZE
-const int PACKET_SIZE    = 1 + BATCH_SIZE * 8;                         // 1 byte seq + 8 bytes per sample (4 IR + 4 Red)
+constexpr int BUFFER_SIZE = PROFILE.bufferSize();   // Power of two for masked indexing
+constexpr int PACKET_SIZE = PROFILE.packetSize();   // 1 byte seq + 8 bytes per sample (4 IR + 4 Red)
+// The chunk size depends on the session's output rate, so it is derived in
+// applyConfig() – with the same roundToBatch() the profile's chunkSize() uses
 
 // ================================================================
 // SENSOR & BLE HARDWARE SETTINGS
 // ================================================================
-const int LED_BRIGHTNESS = 0xF1;   // Max (~50 mA) – reduce if sensor gets hot
 const int SAMPLE_AVERAGE = 1;
 const int LED_MODE       = 2;      // Red + IR
-const int PULSE_WIDTH    = 411;
 const int ADC_RANGE      = 16384;
 
+// Decimation – the sensor can sample faster than the stream needs (800–1600 Hz
+// takes shorter LED pulses, see maxPulseWidthFor()); an anti-alias FIR then
+// averages down to the output rate, which buys SNR per transmitted sample
+const int DECIMATOR_TAPS   = 96;        // Even; 96 taps keep the transition band narrow up to /16
+const int MAX_DECIMATION   = 16;
+const int DECIMATOR_SHIFT  = 11;        // 18-bit samples -> FIR input domain (|x| < 2^30)
+
+// FIFO interrupt acquisition – the MAX30102 INT pin (open-drain, active low) pulls
+// low when the 32-deep hardware FIFO is almost full, so the FIFO gets drained even
+// while the transmit path is busy inside the BLE stack. Set USE_FIFO_INTERRUPT = false if
+// INT is not wired; pollSensor() then drains the FIFO on every call instead.
+const bool USE_FIFO_INTERRUPT = true;
+const int  SENSOR_INT_PIN     = 2;
+const int  FIFO_DEPTH         = 32;
+const int  FIFO_A_FULL_FREE   = 15;     // Interrupt when only this many slots are left (0–15)
+
+// Low-power burst mode – the CPU sleeps (WFE) until the FIFO interrupt, the ring
+// collects burstMs of samples, and the radio wakes only every few connection events
+// (slave latency) until a burst is due
+const int      FIFO_WAKE_MARGIN_MS = 4;    // FIFO slots kept free for wake-up + I2C latency
+const uint16_t FAST_CONN_INTERVAL  = 12;   // 15 ms (1.25 ms units) – continuous streaming
+const uint16_t BURST_CONN_INTERVAL = 80;   // 100 ms
+const uint16_t MAX_SLAVE_LATENCY   = 30;   // Connection events the peripheral may skip when idle
+
+// Store-and-forward – internal flash (the Nano 33 BLE has no QSPI part), written
+// only while disconnected. A page erase stalls the CPU, so the sensor FIFO must
+// cover FLASH_ERASE_MS, which limits this mode to sensor rates below ~350 Hz.
+// Superloop build only: the threaded build rejects 'store_forward'.
+const uint32_t      FLASH_LOG_BYTES   = 256UL * 1024;   // ~3.5 min at 200 Hz
+const int           FLASH_ERASE_MS    = 90;             // nRF52840 page erase, worst case
+const unsigned long MAX_HOLD_SECONDS  = 1800;           // Give up on the central after this long
+
+// BLE link – v2 packets are sized at runtime from the negotiated ATT MTU
+const int MAX_ATT_MTU        = 247;     // Largest MTU that fits one 251-byte LL PDU (with DLE)
+const int DEFAULT_ATT_MTU    = 23;
+const int ATT_NOTIFY_HEADER  = 3;       // Opcode + attribute handle
+const int MAX_NOTIFY_SIZE    = MAX_ATT_MTU - ATT_NOTIFY_HEADER;
+const bool REQUEST_DLE_2M_PHY = true;   // Ask for Data Length Extension + 2M PHY on connect
+const int MAX_BATCH_SIZE     = (MAX_NOTIFY_SIZE - 1) / V1_BYTES_PER_SAMPLE;
+static_assert(PACKET_SIZE <= MAX_NOTIFY_SIZE, "v1 packet must fit one notification");
+static_assert(BATCH_SIZE <= MAX_BATCH_SIZE, "profile batch size exceeds one notification");
+
+// Transmit flow control. ArduinoBLE's writeValue() spins inside HCI until the
+// controller has a free ACL buffer, so a slow write means the TX queue was full.
+// The scheduler sends up to txBudget packets per loop pass, grows the budget by
+// one while writes return fast, and halves it (and yields) when one blocks.
+const int           TX_BUDGET_MAX   = 8;     // Upper bound of packets per loop pass
+const unsigned long TX_BLOCKED_US   = 400;   // A write slower than this waited for a controller buffer
+
 const char* PPG_SERVICE_UUID  = "180D"; // Re-using standard Heart Rate service UUID
-const char* COMMAND_CHAR_UUID = "2A37"; // Write 'S' = start, 'P' = pause
+const char* COMMAND_CHAR_UUID = "2A37"; // Write 'S' (+ optional wire format byte) = start, 'M' = start metrics-only, 'P' = pause, 'B' = DSP benchmark, 'R' = rate / decimation, 'T' = link throughput test
 const char* DATA_CHAR_UUID    = "2A38";
+const char* CONFIG_CHAR_UUID  = "2A39"; // Write: versioned TLV config (config_protocol.h)
+const char* CONFIG_STATE_UUID = "2A3A"; // Read: active config + status of the last write
+const char* STATS_CHAR_UUID   = "2A3B"; // Read / notify: hot-path stats (hot_path_stats.h)
 
-// ================================================================
-// DEBUG SETTINGS
-// ================================================================
-const int DEBUG_NONE     = 0;
-const int DEBUG_INFO     = 1;
-const int DEBUG_VERBOSE  = 2;
-const int DEBUG_LEVEL    = DEBUG_NONE;   // Set to DEBUG_NONE in production for best performance
+const unsigned long STATS_PERIOD_MS = 1000;   // Stats notification interval while connected
+const unsigned long SERIAL_WAIT_MS  = 2000;   // Boot waits this long for a USB serial monitor, then runs without
+
+// Metrics-only mode – beats are detected on-device and only beat events plus a
+// periodic HR/SpO2 summary go over the air
+const unsigned long METRICS_SUMMARY_MS     = 5000;  // Matches the host's processing cadence
+const int           METRICS_SAMPLES_PER_PASS =      // Bounds detector work per loop pass; the
+                      RTOS_TASKS ? BUFFER_SIZE : 64;  // dsp thread is preemptible and takes it all
+
+// Contact gate – see contact_gate.h; thresholds in 18-bit ADC counts
+const uint32_t CONTACT_MIN_IR     = 10000;             // Below: no finger on the sensor
+const uint32_t CONTACT_CLIP_LEVEL = (1UL << 18) - 256; // At or above: clipped
+const int      CONTACT_RESUME_MS  = 500;               // Good contact needed to start sending again
+
+// Link throughput test ('T' command) – a deterministic generator stands in for
+// the sensor, so the BLE link can be measured on its own. Sample i carries
+// IR = i, Red = ~i (low 18 bits, see throughputTestSample()), which lets the
+// host count every lost sample and time it, even in v1.
+const int SYNTH_MAX_RATE = 8000;        // Hz – beyond what the link carries in any format
+
+// Threaded build (-DRTOS_TASKS=1, see task_split.h) – the wait timeouts only
+// matter when no flag arrives: a missed FIFO edge, INT not wired, the metrics
+// summary timer, or an idle session
+const int      TX_QUEUE_DEPTH     = 8;     // Built packets between the dsp and ble threads
+const uint32_t ACQ_IDLE_WAIT_MS   = 100;   // Acquisition thread while not streaming
+const uint32_t DSP_WAIT_MS        = 5;
+const uint32_t BLE_IDLE_WAIT_MS   = 1;     // ble thread with nothing to send (BLE.poll() cadence)
+const uint32_t BLE_BURST_WAIT_MS  = 10;    // Same in burst mode, where the link is idle most of the time
+static_assert(isPowerOfTwo(TX_QUEUE_DEPTH), "txQueue is an SpscRing");
 
 // ================================================================
 // GLOBAL OBJECTS & RUNTIME STATE
@@ -47,33 +143,131 @@ const int DEBUG_LEVEL    = DEBUG_NONE;   // Set to DEBUG_NONE in production for
 MAX30105 particleSensor;
 
 BLEService        ppgService(PPG_SERVICE_UUID);
-BLECharacteristic commandChar(COMMAND_CHAR_UUID, BLERead | BLEWrite, 1);
-BLECharacteristic dataChar   (DATA_CHAR_UUID,    BLENotify, PACKET_SIZE);
+BLECharacteristic commandChar(COMMAND_CHAR_UUID, BLERead | BLEWrite, 5);
+BLECharacteristic dataChar   (DATA_CHAR_UUID,    BLENotify, MAX_NOTIFY_SIZE);
+BLECharacteristic configChar (CONFIG_CHAR_UUID,  BLEWrite,  CONFIG_MAX_SIZE);
+BLECharacteristic configStateChar(CONFIG_STATE_UUID, BLERead, CONFIG_MAX_SIZE);
+BLECharacteristic statsChar  (STATS_CHAR_UUID,   BLERead | BLENotify, STATS_PACKET_SIZE);
+
+// Session config – reset to these defaults on every connection (see applyConfig())
+const StreamConfig DEFAULT_CONFIG = {
+  (uint16_t)PROFILE.sensorRate(), (uint8_t)PROFILE.decimation,
+  0,                                               // Pulse width: longest the rate allows
+  PROFILE.ledBrightness, (uint8_t)PROFILE.batchSize,
+  PROFILE.chunkMs(), (uint16_t)PROFILE.pacingMs,
+  PROFILE.powerMode, PROFILE.burstMs(), (uint16_t)(PROFILE.bufferHeadroomSeconds * 1000),
+  PROFILE.storeAndForward, (uint16_t)PROFILE.contactPauseSeconds
+};
+StreamConfig streamConfig = DEFAULT_CONFIG;
+
+FirDecimatorQ15x2<DECIMATOR_TAPS> decimator;
+bool     decimatorPrimed = false;
+uint32_t sensorLossCarry = 0;                     // Lost sensor samples not yet a whole output sample
+int      chunkSize = BATCH_SIZE;                  // Samples per chunk (per burst in burst mode)
+uint32_t bufferLimit = BUFFER_SIZE;               // Ring fill at which new samples count as overflow
+unsigned long samplePeriodUs = 1000000UL / SAMPLE_RATE;
+unsigned long decimatorDelayUs = 0;               // FIR group delay, taken off the packet anchor
+
+// Store-and-forward state (see FLASH STORE-AND-FORWARD)
+FlashLog      flashLog;
+bool          sessionHeld = false;               // Central gone, still acquiring into flash
+bool          sessionResumed = false;            // Reconnected to a held session, 'S' resumes it
+unsigned long heldSinceMs = 0;
+FlashBlock    flashBlock;                        // Staging block (hold) / block being backfilled
+bool          backfillLoaded = false;
+int           backfillOffset = 0;                // Samples of flashBlock already sent
+
+ContactGate   contactGate;                       // Closed = bad contact, samples are dropped
+
+// Link throughput test state (see generateTestSamples())
+bool          synthMode = false;
+uint16_t      synthRate = 0;                     // Generated samples per second
+unsigned long synthLastUs = 0;
+uint64_t      synthCarry = 0;                    // Elapsed us x rate not yet a whole sample
 
 // Streaming state
 uint8_t  seqNumber = 0;
+uint8_t  wireFormat = WIRE_FORMAT_V1;             // Negotiated per session by the 'S' command
+bool     metricsMode = false;                     // 'M' session: on-device beat detection
 
-uint32_t irRingBuffer[BUFFER_SIZE];
-uint32_t redRingBuffer[BUFFER_SIZE];
-volatile int writeIndex = 0;
-int  readIndex  = 0;
-volatile int bufferCount = 0;
+BeatDetector  beatDetector;
+unsigned long lastSummaryMs = 0;
 
-uint32_t irChunk[CHUNK_SIZE];
-uint32_t redChunk[CHUNK_SIZE];
+SpscRing<PackedSample, BUFFER_SIZE> sampleRing;   // Producer: FIFO drain, consumer: serviceTransmit()
+
+uint8_t packetBuffer[MAX_NOTIFY_SIZE];             // Outgoing notification, filled from ring slots
+
+#if RTOS_TASKS
+SpscRing<TxPacket<MAX_NOTIFY_SIZE>, TX_QUEUE_DEPTH> txQueue;   // Producer: dsp thread, consumer: ble thread
+rtos::Thread  acquisitionThread(ACQUISITION_PRIORITY, ACQUISITION_STACK, nullptr, "acquisition");
+rtos::Thread  dspThread(DSP_PRIORITY, DSP_STACK, nullptr, "dsp");
+osThreadId_t  bleThreadId = nullptr;                // The Arduino main thread running loop()
+volatile unsigned long fifoIrqUs = 0;               // micros() of the latest FIFO interrupt
+#endif
+
+// Link state, refreshed at the start of every chunk
+uint16_t connHandle  = 0xFFFF;
+uint16_t attMtu      = DEFAULT_ATT_MTU;
+volatile int linkCapacity = DEFAULT_ATT_MTU - ATT_NOTIFY_HEADER;   // Copy for the dsp thread (no BLE calls there)
+
+// Transmit scheduler state (see serviceTransmit())
+int      chunkRemaining = 0;     // Samples of the current chunk not yet packetized
+int      chunkCapacity  = 0;     // Notification size for the current chunk
+int      pendingLen     = 0;     // Bytes of a built-but-unsent packet in packetBuffer (0 = none)
+int      pendingCount   = 0;     // Ring (or backfill block) samples that packet covers
+bool     pendingBackfill = false; // Packet comes from the flash log, not the ring
+uint32_t pendingFirstIndex = 0;  // Absolute index of its first sample
+int      txBudget       = 1;     // Packets per loop pass, adapted to what the link accepts
+unsigned long lastTxMs  = 0;
 
 unsigned long streamingStartTime = 0;
 unsigned long totalSamplesDuringStream = 0;
 bool streaming = false;
 bool sensorConfigured = false;
 
+HotPathStats  stats;                     // Reset per connection, reported every STATS_PERIOD_MS
+unsigned long lastStatsMs = 0;
+uint32_t      statsTicksPerUs = 1;       // Cycle counter ticks per microsecond (1 = micros() fallback)
+
+volatile bool fifoIrqPending = false;    // Set by the INT pin ISR, cleared by drainSensorFifo()
+unsigned long fifoOverflowSamples = 0;   // Samples the sensor itself reported as lost (OVF_COUNTER)
+
+// Absolute sample numbering. Every acquired or lost sample gets an index, so the
+// host can place each packet exactly on the timeline (see wire_format.h).
+uint32_t producedIndex   = 0;            // Producer: index the next acquired sample will get
+uint32_t pendingGap      = 0;            // Producer: samples lost since the last stored one
+unsigned long lastDrainUs = 0;           // Producer: micros() of the latest FIFO drain
+SeqPair       drainAnchor;               // Producer: (producedIndex, lastDrainUs) after each drain, as a pair
+uint32_t consumedIndex   = 0;            // Consumer: index one past the last packetized sample
+
 // ================================================================
-// DEBUGS / PRINTS
+// DEBUGS / PRINTS / STATS
 // ================================================================
 
-// Conditional debug printing – completely compiled out when DEBUG_LEVEL = DEBUG_NONE
-void debugPrint(int level, const char* msg) {
-  if (level <= DEBUG_LEVEL) {
+inline uint32_t statsTicks() {
+  return CYCLE_COUNTER_AVAILABLE ? cycleCount() : (uint32_t)micros();
+}
+
+#if RTOS_TASKS
+void recordStackHighWater();             // THREADED BUILD section
+#endif
+
+void publishStats() {
+  uint8_t packet[STATS_PACKET_SIZE];
+#if RTOS_TASKS
+  recordStackHighWater();
+#endif
+  unsigned long now = millis();
+  int len = encodeStats(packet, stats, now - lastStatsMs, statsTicksPerUs,
+                        sampleRing.size(), fifoOverflowSamples);
+  lastStatsMs = now;
+  statsChar.writeValue(packet, len);
+}
+
+// Conditional debug printing – calls above the profile's debugLevel compile to nothing
+template<int LEVEL>
+void debugPrint(const char* msg) {
+  if constexpr (LEVEL <= DEBUG_LEVEL) {
     Serial.print("[");
     Serial.print(millis());
     Serial.print("] ");
@@ -86,7 +280,7 @@ void printStreamingSummary() {
   if (totalSamplesDuringStream == 0) return;
 
   float elapsedSec = (millis() - streamingStartTime) / 1000.0f;
-  float expected   = elapsedSec * SAMPLE_RATE;
+  float expected   = elapsedSec * (synthMode ? synthRate : streamConfig.sensorRate);
   float missed     = expected - totalSamplesDuringStream;
   float missRate   = (expected > 0) ? (missed / expected) * 100.0f : 0.0f;
 
@@ -96,6 +290,22 @@ void printStreamingSummary() {
   Serial.print("Samples expected: ~"); Serial.println((int)expected);
   Serial.print("Samples missed:   ~"); Serial.print((int)missed);
   Serial.print(" ("); Serial.print(missRate, 1); Serial.println("%)");
+  Serial.print("FIFO overflows:   ");  Serial.println(fifoOverflowSamples);
+  Serial.print("Ring overflows:   ");  Serial.println(stats.ringOverflows);
+  Serial.print("Ring high water:  ");  Serial.print(stats.ringHighWater);
+  Serial.print(" / ");                 Serial.println(BUFFER_SIZE);
+  Serial.print("Notifications:    ");  Serial.print(stats.notifySent);
+  Serial.print(" sent, ");             Serial.print(stats.notifyFailed); Serial.println(" failed");
+  Serial.print("Contact paused:   ");  Serial.print(stats.contactPaused); Serial.println(" samples");
+  Serial.print("CPU asleep:       ");  Serial.print((uint32_t)(stats.sleepUs / 1000)); Serial.println(" ms");
+#if RTOS_TASKS
+  recordStackHighWater();
+  Serial.print("Stack used:       ");  Serial.print(stats.taskStackUsed[TASK_ACQUISITION]);
+  Serial.print(" acq, ");              Serial.print(stats.taskStackUsed[TASK_DSP]);
+  Serial.print(" dsp, ");              Serial.print(stats.taskStackUsed[TASK_BLE]); Serial.println(" ble bytes");
+#endif
+  Serial.print("Output samples:   ");  Serial.print(producedIndex);
+  Serial.print(" (/"); Serial.print(streamConfig.decimation); Serial.println(")");
   Serial.print("Chunks sent: ");       Serial.println(seqNumber);
   Serial.println("================================\n");
 }
@@ -107,20 +317,174 @@ void printStreamingSummary() {
 bool initSensor() {
   // Starts I2C communication with the MAX30102/MAX30105
   if (!particleSensor.begin(Wire, I2C_SPEED_FAST)) {
-    debugPrint(DEBUG_INFO, "MAX30102 not found – check wiring!");
+    debugPrint<DEBUG_INFO>("MAX30102 not found – check wiring!");
     return false;
   }
-  debugPrint(DEBUG_INFO, "Sensor initialized");
+  debugPrint<DEBUG_INFO>("Sensor initialized");
   return true;
 }
 
+void onSensorInterrupt() {
+  // INT pin ISR – I2C is not safe here, so only flag the FIFO for draining
+  fifoIrqPending = true;
+#if RTOS_TASKS
+  fifoIrqUs = micros();
+  signalTask(FLAG_FIFO);                     // Wakes the acquisition thread
+#endif
+}
+
+uint8_t fifoAlmostFullFree() {
+  // Burst mode lets the FIFO fill almost completely between wake-ups
+  if (streamConfig.powerMode != POWER_BURST) return FIFO_A_FULL_FREE;
+  int free = (streamConfig.sensorRate * FIFO_WAKE_MARGIN_MS + 999) / 1000 + 1;
+  return (uint8_t)(free > FIFO_A_FULL_FREE ? FIFO_A_FULL_FREE : free);
+}
+
 void configureSensor() {
-  // Applies the high-performance settings defined above
-  particleSensor.setup(LED_BRIGHTNESS, SAMPLE_AVERAGE, LED_MODE,
-                       SAMPLE_RATE, PULSE_WIDTH, ADC_RANGE);
+  // Applies the session config (the defaults above unless the host changed them)
+  particleSensor.setup(streamConfig.ledBrightness, SAMPLE_AVERAGE, LED_MODE,
+                       streamConfig.sensorRate, streamConfig.pulseWidth, ADC_RANGE);
+  particleSensor.disableFIFORollover();                 // Overflow holds data and bumps OVF_COUNTER
+  particleSensor.setFIFOAlmostFull(fifoAlmostFullFree());
+  if (USE_FIFO_INTERRUPT) particleSensor.enableAFULL();
   particleSensor.clearFIFO();      // Remove any stale data
+  particleSensor.getINT1();        // Reading INT status releases the INT pin
   sensorConfigured = true;
-  debugPrint(DEBUG_INFO, "Sensor configured for 200 Hz streaming");
+  if constexpr (DEBUG_LEVEL >= DEBUG_INFO) {
+    Serial.print("Sensor configured: ");
+    Serial.print(streamConfig.sensorRate); Serial.print(" Hz, ");
+    Serial.print(streamConfig.pulseWidth); Serial.print(" us pulses, /");
+    Serial.print(streamConfig.decimation); Serial.print(" -> ");
+    Serial.print(streamConfig.outputRate()); Serial.println(" Hz output");
+  }
+}
+
+// ================================================================
+// SESSION CONFIG (CONFIG CHARACTERISTIC / 'R' COMMAND)
+// ================================================================
+
+int maxPulseWidthFor(int sensorRate) {
+  // Longest LED pulse the MAX30102 allows at this rate with both LEDs active
+  // (datasheet SpO2 table); 0 = unsupported rate. Shorter pulses give fewer
+  // ADC bits (411 us: 18, 215: 17, 118: 16, 69: 15), which decimation recovers.
+  switch (sensorRate) {
+    case 50: case 100: case 200: case 400: return 411;
+    case 800:  return 215;
+    case 1000: return 118;
+    case 1600: return 69;
+    default:   return 0;
+  }
+}
+
+void requestConnectionParams() {
+  // Connection interval to match the power mode. In burst mode, slave latency lets
+  // the peripheral skip events while it only collects samples; a due burst goes
+  // out at the next event, several packets per event.
+  if (connHandle == 0xFFFF) return;
+  uint16_t interval = FAST_CONN_INTERVAL, latency = 0, timeout = 400;   // 4 s
+  if (streamConfig.powerMode == POWER_BURST) {
+    interval = BURST_CONN_INTERVAL;
+    uint32_t events = (uint32_t)streamConfig.burstMs * 4 / (5 * interval);   // burst / (interval x 1.25 ms)
+    latency = events > (uint32_t)MAX_SLAVE_LATENCY + 1 ? MAX_SLAVE_LATENCY : (events > 1 ? events - 1 : 0);
+    uint32_t t = 3UL * (latency + 1) * interval / 8;      // 3x the effective interval, in 10 ms units
+    timeout = t < 100 ? 100 : (t > 3200 ? 3200 : t);
+  }
+  HCI.leConnUpdate(connHandle, interval / 2, interval, latency, timeout);
+  debugPrint<DEBUG_INFO>("Requested connection parameter update");
+}
+
+uint8_t applyConfig(StreamConfig cfg) {
+  // Validates and applies a complete config; everything that depends on it is
+  // derived here. Returns a CFG_STATUS_* code and leaves the old config on error.
+  int maxPulse = maxPulseWidthFor(cfg.sensorRate);
+  if (cfg.pulseWidth == 0) cfg.pulseWidth = (uint16_t)maxPulse;
+  bool pulseOk = cfg.pulseWidth == 69 || cfg.pulseWidth == 118 ||
+                 cfg.pulseWidth == 215 || cfg.pulseWidth == 411;
+  if (maxPulse == 0 || !pulseOk || cfg.pulseWidth > maxPulse) return CFG_STATUS_BAD_VALUE;
+  if (cfg.decimation < 1 || cfg.decimation > MAX_DECIMATION) return CFG_STATUS_BAD_VALUE;
+  if (cfg.sensorRate % cfg.decimation != 0 || cfg.outputRate() > MAX_OUTPUT_RATE) return CFG_STATUS_BAD_VALUE;
+  if (cfg.batchSize < 1 || cfg.batchSize > MAX_BATCH_SIZE) return CFG_STATUS_BAD_VALUE;
+  if (cfg.chunkMs < 20 || cfg.chunkMs > 1000 || cfg.pacingMs > 1000) return CFG_STATUS_BAD_VALUE;
+  if (cfg.powerMode > POWER_BURST || cfg.storeForward > 1) return CFG_STATUS_BAD_VALUE;
+  if (cfg.contactPauseS > 3600) return CFG_STATUS_BAD_VALUE;
+  if (cfg.storeForward && (RTOS_TASKS || !flashLog.ready() || FIFO_DEPTH * 1000 / cfg.sensorRate <= FLASH_ERASE_MS))
+    return CFG_STATUS_BAD_VALUE;
+  uint32_t bufferSamples = (uint32_t)cfg.outputRate() * cfg.bufferMs / 1000;
+  uint32_t burstSamples  = (uint32_t)cfg.outputRate() * cfg.burstMs / 1000;
+  if (bufferSamples > BUFFER_SIZE || bufferSamples < 2 * (uint32_t)cfg.batchSize) return CFG_STATUS_BAD_VALUE;
+  if (cfg.powerMode == POWER_BURST &&                          // Keep room to acquire while a burst drains
+      (burstSamples < cfg.batchSize || burstSamples > bufferSamples * 3 / 4)) return CFG_STATUS_BAD_VALUE;
+
+  bool acquisitionChanged = cfg.sensorRate != streamConfig.sensorRate ||
+                            cfg.decimation != streamConfig.decimation ||
+                            cfg.pulseWidth != streamConfig.pulseWidth ||
+                            cfg.powerMode  != streamConfig.powerMode;
+  bool linkChanged = cfg.powerMode != streamConfig.powerMode ||
+                     (cfg.powerMode == POWER_BURST && cfg.burstMs != streamConfig.burstMs);
+  streamConfig = cfg;
+  int outputRate = cfg.outputRate();
+  if (acquisitionChanged) decimator.design(cfg.decimation);   // Live writes keep the filter state
+  decimatorDelayUs = cfg.decimation > 1 ? (unsigned long)(decimator.delay() * 1000000.0f / cfg.sensorRate) : 0;
+  samplePeriodUs = 1000000UL / outputRate;
+  contactGate.configure(CONTACT_MIN_IR, CONTACT_CLIP_LEVEL, (uint32_t)outputRate * cfg.contactPauseS,
+                        (uint32_t)outputRate * CONTACT_RESUME_MS / 1000);
+
+  bufferLimit = bufferSamples;
+  int rawChunk = cfg.powerMode == POWER_BURST ? (int)burstSamples : (int)((long)outputRate * cfg.chunkMs / 1000);
+  chunkSize = roundToBatch(rawChunk, cfg.batchSize);       // Whole v1 packets
+
+  if (sensorConfigured) {
+    if (acquisitionChanged) {
+      configureSensor();                                     // Paused session: takes effect on resume
+    } else {
+      particleSensor.setPulseAmplitudeRed(cfg.ledBrightness);   // Live – no FIFO reset
+      particleSensor.setPulseAmplitudeIR(cfg.ledBrightness);
+    }
+  }
+  if (linkChanged) requestConnectionParams();
+  return CFG_STATUS_OK;
+}
+
+void publishConfigState(uint8_t status) {
+  uint8_t state[CONFIG_MAX_SIZE];
+  int len = encodeConfigState(state, streamConfig, status, (uint16_t)chunkSize);
+  configStateChar.writeValue(state, len);
+}
+
+bool sameSessionSettings(const StreamConfig& a, const StreamConfig& b) {
+  // Everything except what may change while streaming (LED, pacing, contact pause)
+  return a.sensorRate == b.sensorRate && a.decimation == b.decimation &&
+         a.pulseWidth == b.pulseWidth && a.batchSize == b.batchSize &&
+         a.chunkMs == b.chunkMs && a.powerMode == b.powerMode &&
+         a.burstMs == b.burstMs && a.bufferMs == b.bufferMs &&
+         a.storeForward == b.storeForward;
+}
+
+void handleConfigWrite() {
+  // Applies a TLV write on top of the active config (all-or-nothing). While
+  // streaming, tags other than LED, pacing and contact pause may only repeat
+  // the active values – which is what a host reconnecting to a held session sends.
+  if (!configChar.written()) return;
+
+  SessionLock lock;
+  StreamConfig cfg = streamConfig;
+  uint32_t seen = 0;
+  uint8_t status = parseConfig(configChar.value(), configChar.valueLength(), cfg, seen);
+  if (status == CFG_STATUS_OK) {
+    if ((seen & (1UL << CFG_SENSOR_RATE)) && !(seen & (1UL << CFG_PULSE_WIDTH))) cfg.pulseWidth = 0;
+    if (cfg.pulseWidth == 0) cfg.pulseWidth = (uint16_t)maxPulseWidthFor(cfg.sensorRate);
+    if (streaming && !sameSessionSettings(cfg, streamConfig)) status = CFG_STATUS_BUSY;
+    else status = applyConfig(cfg);
+  }
+  if (status != CFG_STATUS_OK) debugPrint<DEBUG_INFO>("Config write rejected");
+  publishConfigState(status);
+}
+
+void initSensorInterrupt() {
+  if (!USE_FIFO_INTERRUPT) return;
+  pinMode(SENSOR_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(SENSOR_INT_PIN), onSensorInterrupt, FALLING);
+  debugPrint<DEBUG_INFO>("FIFO interrupt attached");
 }
 
 void shutdownSensor() {
@@ -128,157 +492,989 @@ void shutdownSensor() {
   if (sensorConfigured) {
     particleSensor.shutDown();
     sensorConfigured = false;
-    debugPrint(DEBUG_INFO, "Sensor shut down (power saving)");
+    debugPrint<DEBUG_INFO>("Sensor shut down (power saving)");
   }
 }
 
 bool initBLE() {
   if (!BLE.begin()) {
-    debugPrint(DEBUG_INFO, "BLE initialization failed!");
+    debugPrint<DEBUG_INFO>("BLE initialization failed!");
     return false;
   }
   BLE.setLocalName("PPG_Sensor");
   BLE.setAdvertisedService(ppgService);
+  ATT.setMaxMtu(MAX_ATT_MTU);
   ppgService.addCharacteristic(commandChar);
   ppgService.addCharacteristic(dataChar);
+  ppgService.addCharacteristic(configChar);
+  ppgService.addCharacteristic(configStateChar);
+  ppgService.addCharacteristic(statsChar);
   BLE.addService(ppgService);
   BLE.advertise();
-  debugPrint(DEBUG_INFO, "BLE advertising started");
+  debugPrint<DEBUG_INFO>("BLE advertising started");
   return true;
 }
 
+// ================================================================
+// BLE LINK TUNING (MTU / DLE / PHY)
+// ================================================================
+
+uint16_t lookupConnectionHandle(BLEDevice& central) {
+  // ArduinoBLE only exposes the handle by address: parse "aa:bb:..:ff" (MSB
+  // first) back into its little-endian bytes and try public then random type
+  String str = central.address();
+  uint8_t addr[6];
+  for (int i = 0; i < 6; i++) {
+    addr[5 - i] = (uint8_t)strtoul(str.c_str() + i * 3, nullptr, 16);
+  }
+  for (uint8_t type = 0; type <= 1; type++) {
+    uint16_t handle = ATT.connectionHandle(type, addr);
+    if (handle != 0xFFFF) return handle;
+  }
+  return 0xFFFF;
+}
+
+void requestFastLink(uint16_t handle) {
+  // Both are requests – the controller falls back if the central lacks support
+  if (!REQUEST_DLE_2M_PHY || handle == 0xFFFF) return;
+
+  uint8_t dle[6] = { (uint8_t)handle, (uint8_t)(handle >> 8),
+                     251, 0,                    // TX octets
+                     0x48, 0x08 };              // TX time 2120 us
+  HCI.sendCommand(0x2022, sizeof(dle), dle);    // LE Set Data Length
+
+  uint8_t phy[7] = { (uint8_t)handle, (uint8_t)(handle >> 8),
+                     0x00,                      // ALL_PHYS: state TX and RX preference
+                     0x02, 0x02,                // Prefer LE 2M for TX and RX
+                     0x00, 0x00 };              // No coded-PHY options
+  HCI.sendCommand(0x2032, sizeof(phy), phy);    // LE Set PHY
+  debugPrint<DEBUG_INFO>("Requested DLE + 2M PHY");
+}
+
+void onCentralConnected(BLEDevice& central) {
+  connHandle = lookupConnectionHandle(central);
+  attMtu = DEFAULT_ATT_MTU;
+  requestFastLink(connHandle);
+  if (streamConfig.powerMode == POWER_BURST) requestConnectionParams();
+}
+
+int refreshLinkCapacity() {
+  // Bytes one notification can carry on the current link
+  if (connHandle != 0xFFFF) {
+    uint16_t mtu = ATT.mtu(connHandle);
+    if (mtu >= DEFAULT_ATT_MTU) attMtu = mtu;
+  }
+  int capacity = attMtu - ATT_NOTIFY_HEADER;
+  linkCapacity = capacity < MAX_NOTIFY_SIZE ? capacity : MAX_NOTIFY_SIZE;
+  return linkCapacity;
+}
+
+int notifyCapacity() {
+  // The dsp thread packs with the capacity the ble thread last saw
+  return RTOS_TASKS ? linkCapacity : refreshLinkCapacity();
+}
+
+void resetPipeline() {
+  // Empty ring and queues, sample index back at 0 (call with SessionLock held)
+  sampleRing.reset();
+#if RTOS_TASKS
+  txQueue.reset();
+#endif
+  chunkRemaining = pendingLen = pendingCount = 0;
+  producedIndex = consumedIndex = pendingGap = 0;
+  drainAnchor.store(0, micros());
+}
+
 void resetStreamingState() {
   // Called on every new connection – guarantees a clean start
   streaming = false;
+  connHandle = 0xFFFF;                // Set again by onCentralConnected()
   seqNumber = 0;
-  writeIndex = readIndex = bufferCount = 0;
+  wireFormat = WIRE_FORMAT_V1;
+  metricsMode = false;
+  synthMode = false;
+  resetPipeline();
+  txBudget = 1;
+  StreamConfig defaults = DEFAULT_CONFIG;
+  if (RTOS_TASKS || !flashLog.ready()) defaults.storeForward = 0;   // Defaults must always apply
+  applyConfig(defaults);
+  publishConfigState(CFG_STATUS_OK);
+  flashLog.clear();
+  sessionHeld = sessionResumed = false;
+  backfillLoaded = pendingBackfill = false;
   totalSamplesDuringStream = 0;
-  debugPrint(DEBUG_INFO, "Streaming state reset");
+  fifoOverflowSamples = 0;
+  stats.reset();
+  lastStatsMs = millis();
+  debugPrint<DEBUG_INFO>("Streaming state reset");
 }
 
 // ================================================================
 // SENSOR DATA ACQUISITION
 // ================================================================
 
+// MAX30102 FIFO registers (read directly – the library's check() only keeps 4 samples)
+const uint8_t REG_INT_STATUS_1 = 0x00;
+const uint8_t REG_FIFO_WR_PTR  = 0x04;
+const uint8_t REG_OVF_COUNTER  = 0x05;
+const uint8_t REG_FIFO_RD_PTR  = 0x06;
+const uint8_t REG_FIFO_DATA    = 0x07;
+const int     BYTES_PER_SAMPLE = 6;      // 3 bytes Red + 3 bytes IR (LED_MODE 2)
+
+uint8_t readSensorRegister(uint8_t reg) {
+  Wire.beginTransmission(MAX30105_ADDRESS);
+  Wire.write(reg);
+  Wire.endTransmission(false);
+  Wire.requestFrom((uint8_t)MAX30105_ADDRESS, (size_t)1);
+  return Wire.available() ? Wire.read() : 0;
+}
+
+void readFifoChannel(uint8_t* out) {
+  // One 3-byte big-endian FIFO channel value, masked to the 18-bit ADC
+  out[0] = Wire.read() & 0x03;
+  out[1] = Wire.read();
+  out[2] = Wire.read();
+}
+
+void storeSample(PackedSample& sample) {
+  if (!synthMode && contactGate.update(sampleValue(sample.ir), sampleValue(sample.red))) {
+    producedIndex++;                             // Bad contact: the host sees a gap, the radio idles
+    pendingGap++;
+    stats.contactPaused++;
+    return;
+  }
+  setSampleGap(sample, (uint16_t)(pendingGap < MAX_SAMPLE_GAP ? pendingGap : MAX_SAMPLE_GAP));
+  producedIndex++;
+  if (sampleRing.size() < bufferLimit && sampleRing.push(sample)) {
+    pendingGap = 0;
+  } else {
+    pendingGap++;                                // Next stored sample carries the hole
+    stats.ringOverflows++;
+    debugPrint<DEBUG_INFO>("BUFFER OVERFLOW");
+  }
+}
+
+void acquireSample(PackedSample& raw) {
+  // Feeds one sensor sample through the decimator; only output-rate samples
+  // reach the ring, so indices and gaps are always in output samples
+  if (streamConfig.decimation == 1) {
+    storeSample(raw);
+    return;
+  }
+
+  int32_t ir  = (int32_t)sampleValue(raw.ir)  << DECIMATOR_SHIFT;
+  int32_t red = (int32_t)sampleValue(raw.red) << DECIMATOR_SHIFT;
+  if (!decimatorPrimed) {
+    decimator.prime(ir, red);
+    decimatorPrimed = true;
+  }
+  int32_t outIr, outRed;
+  if (!decimator.push(ir, red, outIr, outRed)) return;
+
+  const int32_t half = 1 << (DECIMATOR_SHIFT - 1);
+  PackedSample sample;
+  setSampleValue(sample.ir,  (outIr  + half) >> DECIMATOR_SHIFT);
+  setSampleValue(sample.red, (outRed + half) >> DECIMATOR_SHIFT);
+  storeSample(sample);
+}
+
+int drainSensorFifo() {
+  // Burst-reads every sample currently held in the sensor FIFO into the ring buffer
+  fifoIrqPending = false;
+  readSensorRegister(REG_INT_STATUS_1);          // Clears A_FULL so INT can fire again
+
+  uint8_t writePtr = readSensorRegister(REG_FIFO_WR_PTR);
+  uint8_t overflow = readSensorRegister(REG_OVF_COUNTER);
+  uint8_t readPtr  = readSensorRegister(REG_FIFO_RD_PTR);
+
+  int pending = (writePtr - readPtr) & (FIFO_DEPTH - 1);
+  if (overflow > 0) {                            // Full FIFO reads as wr == rd
+    pending = FIFO_DEPTH;
+    fifoOverflowSamples += overflow;
+  }
+  if (pending == 0) return 0;
+  lastDrainUs = micros();
+
+  Wire.beginTransmission(MAX30105_ADDRESS);
+  Wire.write(REG_FIFO_DATA);
+  Wire.endTransmission(false);
+
+  // Keep each I2C read within the Wire buffer and on a whole-sample boundary
+  const int maxPerRead = I2C_BUFFER_LENGTH / BYTES_PER_SAMPLE;
+  int remaining = pending;
+  while (remaining > 0) {
+    int n = remaining < maxPerRead ? remaining : maxPerRead;
+    Wire.requestFrom((uint8_t)MAX30105_ADDRESS, (size_t)(n * BYTES_PER_SAMPLE));
+    for (int i = 0; i < n; i++) {
+      PackedSample sample;
+      readFifoChannel(sample.red);             // FIFO order is LED1 (Red), LED2 (IR)
+      readFifoChannel(sample.ir);
+      acquireSample(sample);
+    }
+    remaining -= n;
+  }
+
+  // With rollover off the FIFO keeps its oldest samples and drops new ones, so
+  // the lost samples come after everything just read. Losses are counted in
+  // output samples; the decimator simply filters across the hole.
+  if (overflow > 0) {
+    sensorLossCarry += overflow;
+    uint32_t lost = sensorLossCarry / streamConfig.decimation;
+    sensorLossCarry -= lost * streamConfig.decimation;
+    pendingGap    += lost;
+    producedIndex += lost;
+  }
+
+  drainAnchor.store(producedIndex, lastDrainUs);
+  totalSamplesDuringStream += pending;
+  stats.recordDrain(pending, sampleRing.size());
+  return pending;
+}
+
+int generateTestSamples() {
+  // Throughput test stand-in for drainSensorFifo(): stores every sample the
+  // test rate says is due by now through the same ring / index path
+  unsigned long now = micros();
+  synthCarry += (uint64_t)(now - synthLastUs) * synthRate;
+  synthLastUs = now;
+  int due = (int)(synthCarry / 1000000UL);
+  synthCarry -= (uint64_t)due * 1000000UL;
+  if (due == 0) return 0;
+
+  for (int i = 0; i < due; i++) {
+    PackedSample sample;
+    throughputTestSample(producedIndex, sample);
+    storeSample(sample);
+  }
+  lastDrainUs = now;                             // Anchors: newest sample is "now"
+  drainAnchor.store(producedIndex, lastDrainUs);
+  totalSamplesDuringStream += due;
+  stats.recordDrain(due, sampleRing.size());
+  return due;
+}
+
 int pollSensor() {
   // Reads all available samples from the sensor FIFO into the ring buffer
   if (!streaming) return 0;
+  if (synthMode) return generateTestSamples();
 
-  particleSensor.check();               // Updates internal FIFO state
-  int samplesRead = 0;
+  // In interrupt mode only touch the I2C bus once the FIFO asked for it. INT is
+  // level-held until cleared, so a still-low pin also counts (covers a missed edge).
+  if (USE_FIFO_INTERRUPT && !fifoIrqPending && digitalRead(SENSOR_INT_PIN) == HIGH) return 0;
 
-  while (particleSensor.available()) {
-    uint32_t ir  = particleSensor.getFIFOIR();
-    uint32_t red = particleSensor.getFIFORed();
-    particleSensor.nextSample();
+  return drainSensorFifo();
+}
 
-    if (bufferCount < BUFFER_SIZE) {
-      irRingBuffer[writeIndex]  = ir;
-      redRingBuffer[writeIndex] = red;
-      writeIndex = (writeIndex + 1) % BUFFER_SIZE;
-      bufferCount++;
-    } else {
-      debugPrint(DEBUG_INFO, "BUFFER OVERFLOW");
+// ================================================================
+// DATA TRANSMISSION (CHUNK → BLE PACKETS)
+// ================================================================
+
+template<typename Source>
+int buildPacketV2(uint8_t* packet, int capacity, const Source& src, int maxSamples,
+                  uint32_t firstIndex, int& count) {
+  // A v2 packet must cover consecutive indices, so it ends before the next gap
+  if (maxSamples > V2_MAX_COUNT) maxSamples = V2_MAX_COUNT;
+  for (int s = 1; s < maxSamples; s++) {
+    if (sampleGap(src.peek(s)) != 0) {
+      maxSamples = s;
+      break;
+    }
+  }
+
+  int payloadCapacity = capacity - V2_HEADER_SIZE;
+  uint8_t* payload = packet + V2_HEADER_SIZE;
+  int len;
+  if (wireFormat == WIRE_FORMAT_V2_DELTA) {
+    len = packPayloadV2Delta(payload, src, maxSamples, payloadCapacity, count);
+  } else {
+    count = v2PackedSamplesFor(payloadCapacity);
+    if (count > maxSamples) count = maxSamples;
+    len = packPayloadV2Packed(payload, src, count);
+  }
+
+  // Coarse acquisition time: walk back from the newest sample of the last
+  // published drain (a drain still in progress walks forward – unsigned wrap)
+  uint32_t drainIndex, drainUs;
+  drainAnchor.load(drainIndex, drainUs);
+  uint32_t anchorUs = drainUs - decimatorDelayUs - (drainIndex - 1 - firstIndex) * samplePeriodUs;
+
+  packet[0] = wireFormat;
+  packet[1] = seqNumber;
+  packet[2] = (uint8_t)count;
+  putBigEndian32(packet + 3, firstIndex);
+  putBigEndian32(packet + 7, anchorUs);
+  return V2_HEADER_SIZE + len;
+}
+
+int buildPacket(uint8_t* packet, int capacity, int maxSamples, int& count) {
+  // Serializes the oldest ring samples in the negotiated wire format. v1 is
+  // always streamConfig.batchSize samples; v2 fills the notification up to capacity bytes.
+  if (wireFormat == WIRE_FORMAT_V1) {
+    int batch = streamConfig.batchSize;
+    packet[0] = seqNumber;                     // Sequence number (helps receiver reorder if needed)
+    uint8_t* dst = packet + 1;
+    for (int s = 0; s < batch; s++, dst += V1_BYTES_PER_SAMPLE) {
+      packSampleV1(dst, sampleRing.peek(s));
     }
+    count = batch;
+    return v1PacketSize(batch);
+  }
 
-    samplesRead++;
-    totalSamplesDuringStream++;
+  return buildPacketV2(packet, capacity, sampleRing, maxSamples,
+                       consumedIndex + sampleGap(sampleRing.peek(0)), count);
+}
+
+bool preparePacket() {
+  // Builds the next packet into packetBuffer. Chunks start once chunkSize
+  // samples are buffered and may span several loop passes.
+  if (chunkRemaining == 0) {
+    if (sampleRing.size() < (size_t)chunkSize) return false;
+    seqNumber++;
+    chunkRemaining = chunkSize;
+    chunkCapacity  = notifyCapacity();
   }
-  return samplesRead;
+
+  int count = 0;
+  int len = buildPacket(packetBuffer, chunkCapacity, chunkRemaining, count);
+  if (count == 0) return false;              // MTU too small for even one sample
+  pendingLen   = len;
+  pendingCount = count;
+  pendingFirstIndex = consumedIndex + sampleGap(sampleRing.peek(0));
+  pendingBackfill = false;
+  return true;
+}
+
+bool prepareBackfillPacket() {
+  // Fills link capacity that live chunks leave unused with samples stored in
+  // flash while the central was away. They carry their own absolute index, so
+  // the host places them regardless of arrival order.
+  if (flashLog.empty() || wireFormat == WIRE_FORMAT_V1 || metricsMode) return false;
+  if (!backfillLoaded) {
+    if (!flashLog.readOldest(flashBlock)) {
+      flashLog.dropOldest();                   // Unreadable block – skip it
+      return false;
+    }
+    backfillLoaded = true;
+    backfillOffset = 0;
+  }
+
+  BlockSource src = { flashBlock.samples + backfillOffset };
+  uint32_t firstIndex = flashBlock.firstIndex + backfillOffset;
+  int count = 0;
+  int len = buildPacketV2(packetBuffer, notifyCapacity(), src, flashBlock.count - backfillOffset,
+                          firstIndex, count);
+  if (count == 0) return false;
+  pendingLen   = len;
+  pendingCount = count;
+  pendingFirstIndex = firstIndex;
+  pendingBackfill = true;
+  return true;
 }
 
 // ================================================================
-// DATA TRANSMISSION (CHUNK → BLE PACKETS)
+// METRICS-ONLY MODE (ON-DEVICE BEAT DETECTION)
 // ================================================================
 
-bool extractChunk() {
-  // Moves the oldest CHUNK_SIZE samples from ring buffer → temporary arrays
-  if (bufferCount < CHUNK_SIZE) return false;
+bool notifyData(const uint8_t* packet, int len, unsigned long& took) {
+  // Every data notification goes through here so the stats see all of them
+  unsigned long t0 = micros();
+  bool ok = dataChar.writeValue(packet, len);
+  took = micros() - t0;
+  stats.recordWrite(ok, took, took > TX_BLOCKED_US);
+  return ok;
+}
 
-  for (int i = 0; i < CHUNK_SIZE; i++) {
-    irChunk[i]  = irRingBuffer[readIndex];
-    redChunk[i] = redRingBuffer[readIndex];
-    readIndex = (readIndex + 1) % BUFFER_SIZE;
+bool emitData(const uint8_t* packet, int len) {
+  // Metrics packets: sent right away, or queued for the ble thread
+#if RTOS_TASKS
+  TxPacket<MAX_NOTIFY_SIZE> queued;
+  queued.len = (uint16_t)len;
+  memcpy(queued.data, packet, len);
+  if (!txQueue.push(queued)) {
+    stats.notifyFailed++;                      // Queue full: dropped like a failed notification
+    return false;
   }
-  bufferCount -= CHUNK_SIZE;
+  signalTask(FLAG_TX);
   return true;
+#else
+  unsigned long took;
+  return notifyData(packet, len, took);
+#endif
 }
 
-bool transmitChunk() {
-  // Packs one chunk into several BLE packets and sends them
-  if (!extractChunk()) return false;
-  seqNumber++;
-  int numPackets = CHUNK_SIZE / BATCH_SIZE;
+void sendBeat(const BeatEvent& beat) {
+  uint8_t packet[BEAT_PACKET_SIZE];
+  packet[0] = METRICS_PACKET_BEAT;
+  putBigEndian32(packet + 1, beat.index);
+  putBigEndian16(packet + 5, beat.rrMs);
+  emitData(packet, sizeof(packet));
+}
 
-  for (int p = 0; p < numPackets; p++) {
-    uint8_t packet[PACKET_SIZE];
-    packet[0] = seqNumber;                     // Sequence number (helps receiver reorder if needed)
+void sendSummary(const MetricsSummary& summary) {
+  uint8_t packet[SUMMARY_PACKET_SIZE];
+  packet[0] = METRICS_PACKET_SUMMARY;
+  putBigEndian32(packet + 1, summary.index);
+  putBigEndian16(packet + 5, summary.hrX10);
+  putBigEndian16(packet + 7, summary.spo2X10);
+  putBigEndian16(packet + 9, summary.rmssdX10);
+  packet[11] = summary.beats;
+  emitData(packet, sizeof(packet));
+}
 
-    int idx = 1;
-    for (int s = 0; s < BATCH_SIZE; s++) {
-      uint32_t ir  = irChunk[p * BATCH_SIZE + s];
-      uint32_t red = redChunk[p * BATCH_SIZE + s];
-
-      // Big-endian packing (consistent across platforms)
-      packet[idx++] = (ir  >> 24) & 0xFF;
-      packet[idx++] = (ir  >> 16) & 0xFF;
-      packet[idx++] = (ir  >>  8) & 0xFF;
-      packet[idx++] =  ir        & 0xFF;
-      packet[idx++] = (red >> 24) & 0xFF;
-      packet[idx++] = (red >> 16) & 0xFF;
-      packet[idx++] = (red >>  8) & 0xFF;
-      packet[idx++] =  red       & 0xFF;
-    }
+int serviceMetrics() {
+  // Runs buffered samples through the beat detector instead of the radio
+  int processed = 0;
+  BeatEvent beat;
+  while (processed < METRICS_SAMPLES_PER_PASS && !sampleRing.empty()) {
+    const PackedSample& sample = sampleRing.peek(0);
+    uint32_t index = consumedIndex + sampleGap(sample);
+    bool found = beatDetector.process(index, sampleValue(sample.ir), sampleValue(sample.red), beat);
+    sampleRing.consume(1);
+    consumedIndex = index + 1;
+    processed++;
+    if (found) sendBeat(beat);
+  }
 
-    dataChar.writeValue(packet, PACKET_SIZE);
-    delay(PACKET_PACING_MS);                   // Prevents BLE stack overflow
+  if (millis() - lastSummaryMs >= METRICS_SUMMARY_MS) {
+    lastSummaryMs = millis();
+    sendSummary(beatDetector.summary());
   }
+  return processed;
+}
+
+// ================================================================
+// DSP MICROBENCHMARK ('B' COMMAND, SERIAL OUTPUT)
+// ================================================================
 
+const int BENCH_SAMPLES = 512;
+int32_t benchA[BENCH_SAMPLES];
+int32_t benchB[BENCH_SAMPLES];
+volatile int32_t benchSink;                   // Keeps results observable to the optimizer
 
-  if (DEBUG_LEVEL >= DEBUG_INFO) {
-    Serial.print("Chunk sent, seq = ");
-    Serial.println(seqNumber - 1);
+void fillBenchSignal() {
+  // Deterministic 18-bit-range PPG-like test signal, both lanes
+  for (int i = 0; i < BENCH_SAMPLES; i++) {
+    float t = (float)i / SAMPLE_RATE;
+    benchA[i] = (int32_t)(100000 + 800 * sinf(2 * M_PI * 1.2f * t)) << BD_INPUT_SHIFT;
+    benchB[i] = (int32_t)(80000  + 500 * sinf(2 * M_PI * 1.2f * t)) << BD_INPUT_SHIFT;
+  }
+}
+
+void reportBench(const char* name, uint32_t cycles, uint32_t usec) {
+  Serial.print(name);
+  if (CYCLE_COUNTER_AVAILABLE) {
+    Serial.print((float)cycles / BENCH_SAMPLES, 1);
+    Serial.println(" cycles/sample (IR+Red)");
+  } else {
+    Serial.print((float)usec / BENCH_SAMPLES, 2);
+    Serial.println(" us/sample (IR+Red)");
   }
-  return true;
+}
+
+void runDspBenchmark() {
+  // Cycles per two-lane sample for each kernel on this board
+  static BiquadCascadeQ31x2<4> q31;
+  static BiquadCascadeQ15x2<2> q15;
+  static FirDecimatorQ15x2<DECIMATOR_TAPS> fir;
+  static MovingSumU32<BD_MAX_WINDOW> msum;
+  static BeatDetector detector;
+
+  cycleCounterEnable();
+  fillBenchSignal();
+  q31.setStage(0, BiquadCoeffs::highpass(0.7f, SAMPLE_RATE, 0.5412f));
+  q31.setStage(1, BiquadCoeffs::highpass(0.7f, SAMPLE_RATE, 1.3066f));
+  q31.setStage(2, BiquadCoeffs::lowpass(10.0f, SAMPLE_RATE, 0.5412f));
+  q31.setStage(3, BiquadCoeffs::lowpass(10.0f, SAMPLE_RATE, 1.3066f));
+  q31.reset();
+  q15.setStage(0, BiquadCoeffs::lowpass(10.0f, SAMPLE_RATE, 0.5412f));
+  q15.setStage(1, BiquadCoeffs::lowpass(10.0f, SAMPLE_RATE, 1.3066f));
+  q15.reset();
+  fir.design(4);
+  msum.begin(30);
+  detector.begin(SAMPLE_RATE);
+
+  Serial.println("\n=== DSP MICROBENCHMARK ===");
+  Serial.print("SIMD kernels: "); Serial.println(DSP_USE_SIMD ? "yes (Cortex-M DSP)" : "no (scalar fallback)");
+
+  uint32_t c0 = cycleCount(); unsigned long u0 = micros();
+  q31.processBlock(benchA, benchB, BENCH_SAMPLES);
+  reportBench("Q31 biquad x4 (block): ", cycleCount() - c0, micros() - u0);
+  benchSink = benchA[BENCH_SAMPLES - 1];
+
+  fillBenchSignal();
+  c0 = cycleCount(); u0 = micros();
+  for (int i = 0; i < BENCH_SAMPLES; i++) {
+    int16_t a = (int16_t)(benchA[i] >> 12), b = (int16_t)(benchB[i] >> 12);
+    q15.step(a, b);
+    benchSink = a + b;
+  }
+  reportBench("Q15 biquad x2 (SMLAD): ", cycleCount() - c0, micros() - u0);
+
+  c0 = cycleCount(); u0 = micros();
+  for (int i = 0; i < BENCH_SAMPLES; i++) {
+    int32_t a, b;
+    if (fir.push(benchA[i], benchB[i], a, b)) benchSink = a + b;
+  }
+  reportBench("FIR 96 taps, /4:       ", cycleCount() - c0, micros() - u0);
+
+  c0 = cycleCount(); u0 = micros();
+  for (int i = 0; i < BENCH_SAMPLES; i++) benchSink = msum.push((uint32_t)benchA[i] >> 8);
+  reportBench("Moving sum (lane A):   ", cycleCount() - c0, micros() - u0);
+
+  BeatEvent beat;
+  c0 = cycleCount(); u0 = micros();
+  for (int i = 0; i < BENCH_SAMPLES; i++) {
+    benchSink = detector.process(i, (uint32_t)benchA[i] >> BD_INPUT_SHIFT,
+                                 (uint32_t)benchB[i] >> BD_INPUT_SHIFT, beat);
+  }
+  reportBench("Beat detector (full):  ", cycleCount() - c0, micros() - u0);
+  Serial.println("==========================\n");
+}
+
+// ================================================================
+// TRANSMIT SCHEDULER
+// ================================================================
+
+void adaptTxBudget(int sent, bool blocked) {
+  if (blocked) {
+    txBudget = txBudget > 1 ? txBudget / 2 : 1;
+  } else if (sent == txBudget && txBudget < TX_BUDGET_MAX) {
+    txBudget++;
+  }
+}
+
+int serviceTransmit() {
+  // Non-blocking: sends as many packets as the link currently takes, then
+  // returns so the loop can keep polling the sensor and the BLE stack
+  if (metricsMode) return serviceMetrics();
+  if (streamConfig.pacingMs > 0 && millis() - lastTxMs < streamConfig.pacingMs) return 0;
+
+  int sent = 0;
+  bool blocked = false;
+  while (sent < txBudget) {
+    if (pendingLen == 0 && !preparePacket() && !prepareBackfillPacket()) break;
+
+    unsigned long took;
+    bool ok = notifyData(packetBuffer, pendingLen, took);
+    if (!ok) {                                   // Not subscribed / link gone – retry next pass
+      blocked = true;
+      break;
+    }
+
+    if (pendingBackfill) {
+      backfillOffset += pendingCount;
+      if (backfillOffset >= flashBlock.count) {
+        flashLog.dropOldest();
+        backfillLoaded = false;
+      }
+    } else {
+      consumedIndex = pendingFirstIndex + pendingCount;
+      sampleRing.consume(pendingCount);          // Slots are free once the stack has the packet
+      chunkRemaining -= pendingCount;
+    }
+    pendingLen = 0;
+    sent++;
+    lastTxMs = millis();
+
+    if constexpr (DEBUG_LEVEL >= DEBUG_INFO) {
+      if (!pendingBackfill && chunkRemaining == 0) {
+        Serial.print("Chunk sent, seq = ");
+        Serial.println(seqNumber);
+      }
+    }
+    if (took > TX_BLOCKED_US) {
+      blocked = true;
+      break;
+    }
+    if (streamConfig.pacingMs > 0) break;        // One packet per pacing gap
+  }
+
+  adaptTxBudget(sent, blocked);
+  return sent;
+}
+
+// ================================================================
+// LOW-POWER BURST MODE (SLEEP BETWEEN FIFO INTERRUPTS)
+// ================================================================
+
+bool canSleep() {
+  // Only when the next thing to do can only be started by an interrupt: the
+  // FIFO filling up, a BLE event, or a command
+  if (!USE_FIFO_INTERRUPT || !streaming || synthMode || streamConfig.powerMode != POWER_BURST) return false;
+  if (fifoIrqPending || digitalRead(SENSOR_INT_PIN) == LOW) return false;
+  if (metricsMode) return sampleRing.empty() && millis() - lastSummaryMs < METRICS_SUMMARY_MS;
+  return pendingLen == 0 && chunkRemaining == 0 && flashLog.empty() &&
+         sampleRing.size() < (size_t)chunkSize;
+}
+
+void sleepUntilInterrupt() {
+  // WFE also returns on any interrupt (the event register covers one that fired
+  // since the checks above), so nothing is missed; the caller just loops again
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  unsigned long t0 = micros();
+  __asm__ volatile ("wfe");
+  stats.sleepUs += micros() - t0;
+#endif
 }
 
 // ================================================================
 // BLE COMMAND HANDLING
 // ================================================================
 
+void selectWireFormat(bool resumed = false) {
+  // 'S' alone keeps the legacy v1 format; {'S', format} requests a v2 format.
+  // The accepted format is acknowledged as {'A', format} so hosts can tell
+  // this firmware apart from one that ignores the second byte; a resumed held
+  // session appends ACK_RESUMED, so the host knows the index continues.
+  uint8_t requested = WIRE_FORMAT_V1;
+  if (commandChar.valueLength() >= 2) requested = commandChar.value()[1];
+
+  bool supported = requested == WIRE_FORMAT_V1 ||
+                   requested == WIRE_FORMAT_V2_PACKED ||
+                   requested == WIRE_FORMAT_V2_DELTA;
+  wireFormat = supported ? requested : WIRE_FORMAT_V1;
+
+  uint8_t ack[3] = { 'A', wireFormat, ACK_RESUMED };
+  commandChar.writeValue(ack, resumed ? 3 : 2);
+}
+
+void selectAcquisition() {
+  // {'R', sensor rate u16 BE, decimation u8}. Answered with {'A', 'R', rate,
+  // decimation} of the config now active – the old one if the request was rejected.
+  // Shorthand for a config write of CFG_SENSOR_RATE + CFG_DECIMATION.
+  if (commandChar.valueLength() >= 4) {
+    const uint8_t* v = commandChar.value();
+    StreamConfig cfg = streamConfig;
+    cfg.sensorRate = (uint16_t)((v[1] << 8) | v[2]);
+    cfg.decimation = v[3];
+    cfg.pulseWidth = 0;
+    uint8_t status = applyConfig(cfg);
+    if (status != CFG_STATUS_OK) debugPrint<DEBUG_INFO>("Rejected rate / decimation");
+    publishConfigState(status);
+  }
+
+  uint8_t ack[5] = { 'A', 'R', (uint8_t)(streamConfig.sensorRate >> 8),
+                     (uint8_t)streamConfig.sensorRate, (uint8_t)streamConfig.decimation };
+  commandChar.writeValue(ack, sizeof(ack));
+}
+
+void startThroughputTest() {
+  // {'T', format, rate u16 BE}: streams generated samples at rate (default: the
+  // output rate) in the requested format, acknowledged like 'S'. Batch, chunk
+  // and pacing come from the session config, so they can be tuned against the
+  // numbers the host measures; chunk and buffer are re-derived for the rate.
+  selectWireFormat();
+  uint16_t rate = 0;
+  if (commandChar.valueLength() >= 4) {
+    const uint8_t* v = commandChar.value();
+    rate = (uint16_t)((v[2] << 8) | v[3]);
+  }
+  if (rate == 0 || rate > SYNTH_MAX_RATE) rate = (uint16_t)streamConfig.outputRate();
+
+  synthRate = rate;
+  samplePeriodUs = 1000000UL / rate;
+  decimatorDelayUs = 0;
+  bufferLimit = BUFFER_SIZE;
+  int rawChunk = (int)((long)rate * streamConfig.chunkMs / 1000);
+  chunkSize = roundToBatch(rawChunk, streamConfig.batchSize);
+
+  resetPipeline();                  // Every test starts at index 0 (the host measures from there)
+  totalSamplesDuringStream = 0;
+  metricsMode = false;
+  synthMode = true;
+  synthCarry = 0;
+  synthLastUs = micros();
+  streaming = true;
+  streamingStartTime = millis();
+}
+
+void startStreaming() {
+  if (!sensorConfigured) configureSensor();
+  particleSensor.clearFIFO();       // Drop samples queued while paused
+  particleSensor.getINT1();
+  fifoIrqPending = false;
+  decimator.reset();                // The FIFO restart is a discontinuity
+  decimatorPrimed = false;
+  sensorLossCarry = 0;
+  contactGate.reset();
+  streaming = true;
+  streamingStartTime = millis();
+}
+
 bool handleCommands() {
   // Checks if the client wrote to the command characteristic
   if (!commandChar.written()) return false;
 
+  SessionLock lock;                   // Commands restart / stop the pipeline threads' state
   char cmd = commandChar.value()[0];
 
   if (cmd == 'S' && !streaming) {
-    debugPrint(DEBUG_INFO, "Command: START streaming");
-    if (!sensorConfigured) configureSensor();
-    streaming = true;
-    streamingStartTime = millis();
+    debugPrint<DEBUG_INFO>("Command: START streaming");
+    selectWireFormat();
+    metricsMode = false;
+    startStreaming();
+    return true;
+  }
+  else if (cmd == 'S' && sessionResumed) {
+    debugPrint<DEBUG_INFO>("Command: RESUME held session");
+    selectWireFormat(true);           // Acknowledged like a start, flagged: the index continues
+    sessionResumed = false;
+    pendingLen = 0;                   // Rebuild in the (possibly new) format – nothing was consumed
+    return true;
+  }
+  else if (cmd == 'M' && !streaming) {
+    debugPrint<DEBUG_INFO>("Command: START metrics-only streaming");
+    uint8_t ack[2] = { 'A', WIRE_FORMAT_METRICS };
+    commandChar.writeValue(ack, sizeof(ack));
+    metricsMode = true;
+    beatDetector.begin(streamConfig.outputRate());
+    lastSummaryMs = millis();
+    startStreaming();
+    return true;
+  }
+  else if (cmd == 'R' && !streaming) {
+    debugPrint<DEBUG_INFO>("Command: set rate / decimation");
+    selectAcquisition();
+    return true;
+  }
+  else if (cmd == 'T' && !streaming) {
+    debugPrint<DEBUG_INFO>("Command: START link throughput test");
+    startThroughputTest();
+    return true;
+  }
+  else if (cmd == 'B' && !streaming) {
+    runDspBenchmark();
     return true;
   }
   else if (cmd == 'P') {
-    debugPrint(DEBUG_INFO, "Command: PAUSE streaming");
+    debugPrint<DEBUG_INFO>("Command: PAUSE streaming");
     streaming = false;
+    sessionResumed = false;
     printStreamingSummary();          // Always show stats when pausing
+    if (synthMode) {
+      synthMode = false;
+      applyConfig(streamConfig);      // Restores the chunk / buffer / period the test overrode
+    }
     return true;
   }
   return false;
 }
 
+// ================================================================
+// FLASH STORE-AND-FORWARD (WHILE DISCONNECTED)
+// ================================================================
+
+bool holdSession() {
+  // Keeps a v2 raw session alive across a dropped link if it asked for it
+  if (!streaming || !streamConfig.storeForward || metricsMode || synthMode || wireFormat == WIRE_FORMAT_V1) return false;
+  sessionHeld = true;
+  heldSinceMs = millis();
+  connHandle = 0xFFFF;
+  pendingLen = 0;                     // Unsent packet samples are still in the ring
+  chunkRemaining = 0;
+  backfillLoaded = false;             // Reloaded from flash after the reconnect
+  txBudget = 1;
+  return true;
+}
+
+int serviceFlashLog() {
+  // Moves ring samples into the flash log in whole blocks of consecutive
+  // indices (a block ends early before a gap, like a v2 packet)
+  int written = 0;
+  while (sampleRing.size() >= (size_t)FLASH_BLOCK_SAMPLES) {
+    uint32_t firstIndex = consumedIndex + sampleGap(sampleRing.peek(0));
+    int n = FLASH_BLOCK_SAMPLES;
+    for (int s = 1; s < n; s++) {
+      if (sampleGap(sampleRing.peek(s)) != 0) {
+        n = s;
+        break;
+      }
+    }
+    flashBlock.magic = FLASH_BLOCK_MAGIC;
+    flashBlock.count = (uint8_t)n;
+    flashBlock.reserved = 0;
+    flashBlock.firstIndex = firstIndex;
+    for (int s = 0; s < n; s++) {
+      flashBlock.samples[s] = sampleRing.peek(s);
+      setSampleGap(flashBlock.samples[s], 0);
+    }
+
+    drainSensorFifo();                // Empty FIFO = the most room for a page erase stall
+    if (!flashLog.append(flashBlock)) {
+      debugPrint<DEBUG_INFO>("Flash log write failed");
+      break;
+    }
+    sampleRing.consume(n);
+    consumedIndex = firstIndex + n;
+    written++;
+  }
+  return written;
+}
+
+void serviceHeldSession() {
+  // Runs from loop() while no central is connected
+  pollSensor();
+  serviceFlashLog();
+  if (millis() - heldSinceMs >= MAX_HOLD_SECONDS * 1000UL) {
+    debugPrint<DEBUG_INFO>("Central did not return - ending held session");
+    sessionHeld = false;
+    printStreamingSummary();
+    resetStreamingState();
+    shutdownSensor();
+  }
+}
+
+void resumeHeldSession() {
+  // Reconnect: keep index, config and buffers; the host's 'S' resumes
+  sessionHeld = false;
+  sessionResumed = true;
+  if constexpr (DEBUG_LEVEL >= DEBUG_INFO) {
+    Serial.print("Resuming held session, flash blocks to backfill: ");
+    Serial.println(flashLog.size());
+  }
+}
+
+// ================================================================
+// THREADED BUILD: ACQUISITION / DSP / BLE TASKS (RTOS_TASKS)
+// ================================================================
+#if RTOS_TASKS
+
+int queueLivePackets() {
+  // dsp thread: builds packets ahead of the radio. The bytes are copied into
+  // txQueue, so the ring slots are released as soon as a packet is queued.
+  int queued = 0;
+  while (txQueue.freeSpace() > 0 && preparePacket()) {
+    TxPacket<MAX_NOTIFY_SIZE> packet;
+    packet.len = (uint16_t)pendingLen;
+    memcpy(packet.data, packetBuffer, pendingLen);
+    txQueue.push(packet);
+    consumedIndex = pendingFirstIndex + pendingCount;
+    sampleRing.consume(pendingCount);
+    chunkRemaining -= pendingCount;
+    pendingLen = 0;
+    queued++;
+  }
+  if (queued > 0) signalTask(FLAG_TX);
+  return queued;
+}
+
+int serviceTxQueue() {
+  // ble thread: sends queued packets with the budget / pacing rules of
+  // serviceTransmit(); a failed write keeps the packet for the next pass
+  if (streamConfig.pacingMs > 0 && millis() - lastTxMs < streamConfig.pacingMs) return 0;
+
+  int sent = 0;
+  bool blocked = false;
+  while (sent < txBudget && !txQueue.empty()) {
+    const TxPacket<MAX_NOTIFY_SIZE>& packet = txQueue.peek(0);
+    unsigned long took;
+    if (!notifyData(packet.data, packet.len, took)) {
+      blocked = true;
+      break;
+    }
+    txQueue.consume(1);
+    sent++;
+    lastTxMs = millis();
+    if (took > TX_BLOCKED_US) {
+      blocked = true;
+      break;
+    }
+    if (streamConfig.pacingMs > 0) break;
+  }
+
+  adaptTxBudget(sent, blocked);
+  if (sent > 0) signalTask(FLAG_SAMPLES);        // Queue space: the dsp thread may continue
+  return sent;
+}
+
+uint32_t acquisitionWaitMs() {
+  // INT is level-held, so a timeout of half a FIFO also covers a missed edge
+  // (and is the poll period when INT is not wired); the generator has no IRQ
+  if (!streaming) return ACQ_IDLE_WAIT_MS;
+  if (synthMode) return 1;
+  uint32_t halfFifoMs = (uint32_t)FIFO_DEPTH * 500 / streamConfig.sensorRate;
+  return halfFifoMs > 1 ? halfFifoMs : 1;
+}
+
+void acquisitionTask() {
+  for (;;) {
+    waitTask(FLAG_FIFO, acquisitionWaitMs());
+    if (!streaming) continue;
+    uint32_t start = statsTicks();
+    if (fifoIrqPending) stats.recordWake(micros() - fifoIrqUs);
+
+    int drained;
+    {
+      ProducerLock lock;
+      drained = pollSensor();
+    }
+    if (drained > 0) signalTask(FLAG_SAMPLES);
+    stats.recordTask(TASK_ACQUISITION, statsTicks() - start);
+  }
+}
+
+void dspTask() {
+  for (;;) {
+    waitTask(FLAG_SAMPLES, DSP_WAIT_MS);
+    if (!streaming) continue;
+    uint32_t start = statsTicks();
+    {
+      ConsumerLock lock;
+      if (metricsMode) serviceMetrics();
+      else             queueLivePackets();
+    }
+    stats.recordTask(TASK_DSP, statsTicks() - start);
+  }
+}
+
+void startTasks() {
+  bleThreadId = osThreadGetId();
+  acquisitionThread.start(acquisitionTask);
+  dspThread.start(dspTask);
+  debugPrint<DEBUG_INFO>("Acquisition and DSP threads started");
+}
+
+void recordStackHighWater() {
+  stats.taskStackUsed[TASK_ACQUISITION] = stackHighWater(acquisitionThread.get_id());
+  stats.taskStackUsed[TASK_DSP]         = stackHighWater(dspThread.get_id());
+  stats.taskStackUsed[TASK_BLE]         = stackHighWater(bleThreadId);
+}
+
+void serviceConnection() {
+  // One pass of the ble thread while connected; waits instead of spinning
+  // when there is nothing to send, so the idle thread can sleep
+  uint32_t loopStart = statsTicks();
+  handleCommands();
+  handleConfigWrite();
+  refreshLinkCapacity();
+  int sent = serviceTxQueue();
+  BLE.poll();
+  uint32_t ticks = statsTicks() - loopStart;
+  stats.recordLoop(ticks);
+  stats.recordTask(TASK_BLE, ticks);
+  if (millis() - lastStatsMs >= STATS_PERIOD_MS) publishStats();
+  if (sent == 0) waitTask(FLAG_TX, streamConfig.powerMode == POWER_BURST ? BLE_BURST_WAIT_MS : BLE_IDLE_WAIT_MS);
+}
+
+#endif
+
 // ================================================================
 // DISCONNECT / CLEANUP
 // ================================================================
 
 void handleDisconnect() {
   // Runs when the central disconnects
+  SessionLock lock;
+  if (holdSession()) {
+    BLE.advertise();                  // Acquisition continues into flash
+    debugPrint<DEBUG_INFO>("Disconnected - holding session, re-advertising");
+    return;
+  }
   printStreamingSummary();            // Final statistics
   resetStreamingState();
   shutdownSensor();
   BLE.advertise();                    // Ready for next connection
-  debugPrint(DEBUG_INFO, "Disconnected - re-advertising");
+  debugPrint<DEBUG_INFO>("Disconnected - re-advertising");
 }
 
 // ================================================================
@@ -287,23 +1483,46 @@ void handleDisconnect() {
 
 void setup() {
   Serial.begin(115200);
-  while (!Serial);            // Remove this line in battery-powered/production builds
+  while (!Serial && millis() < SERIAL_WAIT_MS);   // Don't hang forever without USB (battery / field builds)
+  cycleCounterEnable();
+  if (CYCLE_COUNTER_AVAILABLE) statsTicksPerUs = SystemCoreClock / 1000000UL;
 
   if (!initSensor()) while (1);   // Halt if sensor missing
+  initSensorInterrupt();
   if (!initBLE())    while (1);   // Halt if BLE fails
+  if (!flashLog.begin(FLASH_LOG_BYTES)) debugPrint<DEBUG_INFO>("Flash log unavailable - no store-and-forward");
+#if RTOS_TASKS
+  startTasks();
+#endif
 }
 
 void loop() {
   BLEDevice central = BLE.central();
   if (central) {                   // PC Host just connected
-    resetStreamingState();
+    {
+      SessionLock lock;
+      if (sessionHeld) resumeHeldSession();
+      else             resetStreamingState();
+      onCentralConnected(central);
+    }
 
     while (central.connected()) {
+#if RTOS_TASKS
+      serviceConnection();         // Acquisition and packing run in their own threads
+#else
+      if (canSleep()) sleepUntilInterrupt();   // Burst mode only; not counted as loop time
+      uint32_t loopStart = statsTicks();
       handleCommands();            // Check for Start / Pause commands
+      handleConfigWrite();         // Runtime config (TLV) from the host
       pollSensor();                // Fill ring buffer
-      transmitChunk();             // Send buffered data
+      serviceTransmit();           // Send what the link can take right now
       BLE.poll();                  // processes BLE events, prevents hangs
+      stats.recordLoop(statsTicks() - loopStart);
+      if (millis() - lastStatsMs >= STATS_PERIOD_MS) publishStats();
+#endif
     }
     handleDisconnect();             // Cleanup & re-advertise
+  } else if (sessionHeld) {
+    serviceHeldSession();           // Keep acquiring into flash until the central returns
   }
 }
\ No newline at end of file
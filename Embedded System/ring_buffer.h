@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// ================================================================
+// LOCK-FREE SINGLE-PRODUCER / SINGLE-CONSUMER RING BUFFER
+// ================================================================
+// One side (sensor acquisition – ISR, thread or main loop) only ever calls push(),
+// the other side (packetizer) only ever calls peek()/consume(). head and tail
+// are free-running counters owned by one side each, so no read-modify-write is ever
+// shared and no interrupt masking is needed. N must be a power of two so that the
+// slot index is a mask rather than a modulo, and so that counter wrap-around at
+// 2^32 stays consistent.
+
+constexpr size_t nextPowerOfTwo(size_t n) {
+  size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+template<typename T, size_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+  static_assert(N <= 0x80000000UL, "SpscRing size must fit the 32-bit counters");
+
+public:
+  // ---------------- Producer side ----------------
+  bool push(const T& item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);   // See slots the consumer freed
+    if (head - tail >= N) return false;                      // Full – caller counts the overflow
+    slots_[head & MASK] = item;
+    head_.store(head + 1, std::memory_order_release);        // Publish the slot contents
+    return true;
+  }
+
+  size_t freeSpace() const {
+    return N - size();
+  }
+
+  // ---------------- Consumer side ----------------
+  size_t size() const {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    return head - tail;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  // i-th oldest element; only valid for i < size()
+  const T& peek(size_t i) const {
+    return slots_[(tail_.load(std::memory_order_relaxed) + i) & MASK];
+  }
+
+  // Releases the n oldest elements back to the producer
+  void consume(size_t n) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+  }
+
+  // Only call while neither side is running (e.g. between streaming sessions)
+  void reset() {
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr uint32_t MASK = N - 1;
+
+  T slots_[N];
+  std::atomic<uint32_t> head_{0};   // Written by producer only
+  std::atomic<uint32_t> tail_{0};   // Written by consumer only
+};
+
+// ================================================================
+// SINGLE-WRITER SNAPSHOT OF TWO WORDS (SEQLOCK)
+// ================================================================
+// For two values the consumer must see as a pair (the producer's sample index
+// and the time of the drain that produced it): the writer makes the version odd,
+// stores both, then makes it even again; a reader retries while the version is
+// odd or changed under it. The writer never waits, so it may preempt the reader.
+
+class SeqPair {
+public:
+  void store(uint32_t a, uint32_t b) {
+    uint32_t v = version_.load(std::memory_order_relaxed);
+    version_.store(v + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    a_.store(a, std::memory_order_relaxed);
+    b_.store(b, std::memory_order_relaxed);
+    version_.store(v + 2, std::memory_order_release);
+  }
+
+  void load(uint32_t& a, uint32_t& b) const {
+    uint32_t before, after;
+    do {
+      before = version_.load(std::memory_order_acquire);
+      a = a_.load(std::memory_order_relaxed);
+      b = b_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = version_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+  }
+
+private:
+  std::atomic<uint32_t> version_{0};
+  std::atomic<uint32_t> a_{0};
+  std::atomic<uint32_t> b_{0};
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+// ================================================================
+// RTOS TASK SPLIT (OPTIONAL THREADED BUILD)
+// ================================================================
+// With -DRTOS_TASKS=1 on mbed OS (Arduino Nano 33 BLE core) the superloop is
+// split into three threads instead of running sensor I/O, packing and the BLE
+// stack one after another:
+//   acquisition  realtime      FIFO IRQ -> I2C drain -> decimator -> sampleRing
+//   dsp          above normal  sampleRing -> packets / beat detector -> txQueue
+//   ble          normal        loop(): BLE.poll(), commands, txQueue -> notify
+// Acquisition and dsp share only lock-free state (sampleRing and the drain
+// anchor, a SeqPair), dsp and ble only the bounded txQueue, so a writeValue()
+// stuck in HCI never delays a FIFO drain.
+// ArduinoBLE is not thread-safe: every BLE call stays on the ble thread.
+//
+// The control path (commands, config writes, connect / disconnect) rewrites
+// state both pipeline threads own, so it holds SessionLock: the producer mutex
+// (held by acquisition around a drain) and the consumer mutex (held by dsp
+// around a pass). The pipeline threads never share a mutex with each other.
+// The stats counters are updated without locks (word-sized, nearly all with a
+// single writing thread); a report can at worst move one drain or write into
+// the next window. In the superloop build
+// (RTOS_TASKS = 0) the locks compile to nothing.
+
+#ifndef RTOS_TASKS
+#define RTOS_TASKS 0
+#endif
+
+#if RTOS_TASKS
+#if !defined(ARDUINO_ARCH_MBED)
+#error "RTOS_TASKS needs mbed OS (Arduino Nano 33 BLE core)"
+#endif
+
+#include <mbed.h>
+
+const osPriority_t ACQUISITION_PRIORITY = osPriorityRealtime;
+const osPriority_t DSP_PRIORITY         = osPriorityAboveNormal;
+const uint32_t     ACQUISITION_STACK    = 2048;   // I2C drain + decimator, no deep calls
+const uint32_t     DSP_STACK            = 3072;   // Packet builders + beat detector
+
+// Event flags: one bit per waiting thread
+const uint32_t FLAG_FIFO    = 1u << 0;            // ISR -> acquisition: FIFO almost full
+const uint32_t FLAG_SAMPLES = 1u << 1;            // acquisition -> dsp: new ring samples
+const uint32_t FLAG_TX      = 1u << 2;            // dsp -> ble: txQueue has packets
+
+inline rtos::Mutex      producerMutex;
+inline rtos::Mutex      consumerMutex;
+inline rtos::EventFlags taskFlags;
+
+inline void signalTask(uint32_t flag) { taskFlags.set(flag); }    // ISR-safe
+inline void waitTask(uint32_t flag, uint32_t timeoutMs) { taskFlags.wait_any(flag, timeoutMs); }
+
+// Bytes of a thread's stack that were ever used (RTX watermark; without
+// stack watermarking RTX reports no free space, i.e. the whole stack)
+inline uint32_t stackHighWater(osThreadId_t id) {
+  if (id == nullptr) return 0;
+  return osThreadGetStackSize(id) - osThreadGetStackSpace(id);
+}
+
+struct ProducerLock {
+  ProducerLock()  { producerMutex.lock(); }
+  ~ProducerLock() { producerMutex.unlock(); }
+};
+
+struct ConsumerLock {
+  ConsumerLock()  { consumerMutex.lock(); }
+  ~ConsumerLock() { consumerMutex.unlock(); }
+};
+
+#else
+
+inline void signalTask(uint32_t) {}
+
+struct ProducerLock { ProducerLock() {} };
+struct ConsumerLock { ConsumerLock() {} };
+
+#endif
+
+// Always taken in this order (producer, then consumer)
+struct SessionLock {
+  ProducerLock producer;
+  ConsumerLock consumer;
+};
+
+// One packet built by the dsp thread, waiting for the ble thread
+template<int MAX_LEN>
+struct TxPacket {
+  uint16_t len;
+  uint8_t  data[MAX_LEN];
+};
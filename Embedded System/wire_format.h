@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ================================================================
+// BLE SAMPLE WIRE FORMATS
+// ================================================================
+// v1 (legacy, default):  [seq u8] + BATCH_SIZE x (IR u32 BE, Red u32 BE)
+// v2 header (all v2):    [format u8][seq u8][count u8][index u32 BE][anchor_us u32 BE]
+//                        + payload. count is however many samples fit the ATT MTU,
+//                        index is the absolute sample number of the first sample
+//                        (never wraps within a session; the samples of one packet
+//                        are always consecutive) and anchor_us is a coarse
+//                        micros() estimate of when that sample was acquired.
+//   WIRE_FORMAT_V2_PACKED: count x (IR 18 bit, Red 18 bit) as one MSB-first
+//                          bitstream, zero-padded to a whole byte
+//   WIRE_FORMAT_V2_DELTA:  first sample as IR u24 BE, Red u24 BE, then for each
+//                          following sample zig-zag LEB128 varints of the IR and
+//                          Red differences. Every packet restarts from an absolute
+//                          sample, so one lost packet never corrupts the next.
+// Metrics-only mode ('M' command, acknowledged as {'A', WIRE_FORMAT_METRICS}):
+//   METRICS_PACKET_BEAT:    [type u8][index u32 BE][rr_ms u16 BE]
+//   METRICS_PACKET_SUMMARY: [type u8][index u32 BE][hr x10 u16 BE][spo2 x10 u16 BE]
+//                           [rmssd x10 u16 BE][beats u8]
+// The host selects a format by writing {'S', format} to the command
+// characteristic; the firmware answers with {'A', format} there, or with
+// {'A', format, ACK_RESUMED} when the 'S' resumed a held session (the index
+// continues; otherwise every start begins again at index 0). A link
+// throughput test ({'T', format, rate u16 BE}) is acknowledged the same way and
+// streams throughputTestSample() values instead of sensor data.
+
+const uint8_t WIRE_FORMAT_V1        = 1;
+const uint8_t ACK_RESUMED           = 'R';
+const uint8_t WIRE_FORMAT_V2_PACKED = 2;
+const uint8_t WIRE_FORMAT_V2_DELTA  = 3;
+const uint8_t WIRE_FORMAT_METRICS   = 0x10;
+
+const uint8_t METRICS_PACKET_BEAT    = 0x10;
+const uint8_t METRICS_PACKET_SUMMARY = 0x11;
+const int     BEAT_PACKET_SIZE       = 7;
+const int     SUMMARY_PACKET_SIZE    = 12;
+
+const int V1_BYTES_PER_SAMPLE = 8;
+const int V2_HEADER_SIZE      = 11;
+const int SAMPLE_BITS         = 18;     // MAX30102 ADC resolution
+
+const int V2_MAX_COUNT        = 255;    // count is a single byte
+const int DELTA_FIRST_BYTES   = 6;      // Absolute IR u24 + Red u24
+const int DELTA_MAX_BYTES     = 6;      // 18-bit difference -> 19-bit zig-zag -> 3 varint bytes, x2
+
+constexpr int v1PacketSize(int samples)          { return 1 + samples * V1_BYTES_PER_SAMPLE; }
+constexpr int v2PackedPayloadSize(int samples)   { return (samples * 2 * SAMPLE_BITS + 7) / 8; }
+constexpr int v2PackedSamplesFor(int payloadLen) { return payloadLen * 8 / (2 * SAMPLE_BITS); }
+
+// Samples are kept exactly as the sensor FIFO delivers them (18-bit big-endian,
+// 3 bytes per channel), so the packetizer copies bytes straight into the packet.
+struct PackedSample {
+  uint8_t ir[3];
+  uint8_t red[3];
+};
+
+// The 18-bit ADC leaves the top 6 bits of ir[0] and red[0] unused. The producer
+// stores there how many samples were lost right before this one (FIFO or ring
+// overflow; 12 bits, saturating) so the packetizer can keep the index exact.
+const uint16_t MAX_SAMPLE_GAP = 0x0FFF;
+
+inline void setSampleGap(PackedSample& s, uint16_t gap) {
+  if (gap > MAX_SAMPLE_GAP) gap = MAX_SAMPLE_GAP;
+  s.ir[0]  = (uint8_t)((s.ir[0]  & 0x03) | ((gap >> 6)   << 2));
+  s.red[0] = (uint8_t)((s.red[0] & 0x03) | ((gap & 0x3F) << 2));
+}
+
+inline uint16_t sampleGap(const PackedSample& s) {
+  return (uint16_t)(((s.ir[0] >> 2) << 6) | (s.red[0] >> 2));
+}
+
+inline uint32_t sampleValue(const uint8_t* be24) {
+  return (((uint32_t)be24[0] << 16) | ((uint32_t)be24[1] << 8) | be24[2]) & 0x3FFFF;
+}
+
+// Writes an 18-bit value (saturated) in the FIFO's 3-byte layout; gap bits are cleared
+inline void setSampleValue(uint8_t* be24, int32_t value) {
+  uint32_t v = value < 0 ? 0 : (value > 0x3FFFF ? 0x3FFFF : (uint32_t)value);
+  be24[0] = (uint8_t)(v >> 16);
+  be24[1] = (uint8_t)(v >> 8);
+  be24[2] = (uint8_t)v;
+}
+
+// Link throughput test pattern ('T' command): sample i is IR = i, Red = ~i,
+// both truncated to 18 bits, so the host recovers the index from the values
+inline void throughputTestSample(uint32_t index, PackedSample& s) {
+  setSampleValue(s.ir,  (int32_t)(index & 0x3FFFF));
+  setSampleValue(s.red, (int32_t)(~index & 0x3FFFF));
+}
+
+inline void putBigEndian32(uint8_t* dst, uint32_t value) {
+  dst[0] = (uint8_t)(value >> 24);
+  dst[1] = (uint8_t)(value >> 16);
+  dst[2] = (uint8_t)(value >> 8);
+  dst[3] = (uint8_t)value;
+}
+
+inline void putBigEndian16(uint8_t* dst, uint16_t value) {
+  dst[0] = (uint8_t)(value >> 8);
+  dst[1] = (uint8_t)value;
+}
+
+inline void packSampleV1(uint8_t* dst, const PackedSample& sample) {
+  // v1 wire format: IR then Red as big-endian uint32 – the top byte is always zero
+  dst[0] = 0;
+  dst[1] = sample.ir[0] & 0x03;
+  dst[2] = sample.ir[1];
+  dst[3] = sample.ir[2];
+  dst[4] = 0;
+  dst[5] = sample.red[0] & 0x03;
+  dst[6] = sample.red[1];
+  dst[7] = sample.red[2];
+}
+
+// Source is anything with peek(i) -> const PackedSample& (e.g. the SPSC ring).
+// Each packer writes only the payload and returns its length in bytes; the
+// caller sizes count so the payload fits (v2PackedSamplesFor / maxBytes).
+
+template<typename Source>
+int packPayloadV2Packed(uint8_t* dst, const Source& src, int count) {
+  uint64_t acc  = 0;     // Bit accumulator, filled from the right
+  int      bits = 0;
+  int      len  = 0;
+
+  for (int i = 0; i < count; i++) {
+    const PackedSample& s = src.peek(i);
+    acc = (acc << SAMPLE_BITS) | sampleValue(s.ir);
+    acc = (acc << SAMPLE_BITS) | sampleValue(s.red);
+    bits += 2 * SAMPLE_BITS;
+    while (bits >= 8) {
+      bits -= 8;
+      dst[len++] = (uint8_t)(acc >> bits);
+    }
+  }
+  if (bits > 0) dst[len++] = (uint8_t)(acc << (8 - bits));
+  return len;
+}
+
+inline int putZigZagVarint(uint8_t* dst, int32_t value) {
+  uint32_t zz = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  int len = 0;
+  while (zz >= 0x80) {
+    dst[len++] = (uint8_t)(zz | 0x80);
+    zz >>= 7;
+  }
+  dst[len++] = (uint8_t)zz;
+  return len;
+}
+
+// Delta packets are variable length, so this packs greedily: up to maxCount
+// samples while a worst-case sample still fits in maxBytes. The number of
+// samples actually packed is returned through count.
+template<typename Source>
+int packPayloadV2Delta(uint8_t* dst, const Source& src, int maxCount, int maxBytes, int& count) {
+  count = 0;
+  if (maxCount <= 0 || maxBytes < DELTA_FIRST_BYTES) return 0;
+  const PackedSample& first = src.peek(0);
+  int32_t prevIr  = (int32_t)sampleValue(first.ir);
+  int32_t prevRed = (int32_t)sampleValue(first.red);
+  dst[0] = (uint8_t)(prevIr >> 16);  dst[1] = (uint8_t)(prevIr >> 8);  dst[2] = (uint8_t)prevIr;
+  dst[3] = (uint8_t)(prevRed >> 16); dst[4] = (uint8_t)(prevRed >> 8); dst[5] = (uint8_t)prevRed;
+  int len = DELTA_FIRST_BYTES;
+  count = 1;
+
+  for (int i = 1; i < maxCount && len + DELTA_MAX_BYTES <= maxBytes; i++) {
+    const PackedSample& s = src.peek(i);
+    int32_t ir  = (int32_t)sampleValue(s.ir);
+    int32_t red = (int32_t)sampleValue(s.red);
+    len += putZigZagVarint(dst + len, ir - prevIr);
+    len += putZigZagVarint(dst + len, red - prevRed);
+    prevIr  = ir;
+    prevRed = red;
+    count++;
+  }
+  return len;
+}
@@ -0,0 +1,180 @@
+# bench_link.py
+# BLE link benchmark against the firmware's throughput test mode ('T' command):
+# a deterministic generator replaces the sensor, and this counts what arrives –
+# sustained samples/s, lost samples and notifications, and end-to-end latency
+# (sample generation -> host decode) – for each rate and transmit setting
+#
+# Usage: python bench_link.py [--rates 200 800 1600 3200] [--format v1|v2|delta] [--seconds 15]
+#                             [--batch 16] [--chunk-ms 200] [--pacing-ms 0] [--out link_results.json]
+
+import argparse
+import asyncio
+import json
+import time
+
+import numpy as np
+from bleak import BleakScanner, BleakClient
+
+from ble_connection import (SensorSession, decode_stats, COMMAND_UUID, DATA_UUID, STATS_UUID,
+                            WIRE_FORMAT_V1, WIRE_FORMAT_V2_PACKED, WIRE_FORMAT_V2_DELTA)
+
+# ================================================================
+# TUNABLE CONSTANTS
+# ================================================================
+DEVICE_NAME = "PPG_Sensor"
+TEST_RATES = [200, 400, 800, 1600, 3200]     # Generated samples/s (firmware caps at SYNTH_MAX_RATE)
+TEST_SECONDS = 15.0
+DRAIN_SECONDS = 1.5                          # After 'P': ring drains, next stats block is published
+VALUE_MASK = (1 << 18) - 1                   # throughputTestSample(): IR = index, Red = ~index (18 bit)
+FORMATS = {'v1': WIRE_FORMAT_V1, 'v2': WIRE_FORMAT_V2_PACKED, 'delta': WIRE_FORMAT_V2_DELTA}
+
+# ================================================================
+# HOST-SIDE COUNTER
+# ================================================================
+class LinkCounter:
+    """
+    Per-test tally of the generated stream; the firmware numbers every test
+    from index 0 (startThroughputTest() resets the ring). Sample i was generated at
+    t0 + (i + 1) / rate on the firmware; t0 is the host time the 'T' command took
+    effect (midpoint of the write and the ack read, so latencies are good to
+    about half that round trip).
+    """
+
+    def __init__(self, session, rate):
+        self.session = session
+        self.rate = rate
+        self.t0 = None
+        self.next_index = 0          # v1: where the value-derived index is unwrapped from
+        self.packets = self.received = self.highest = 0
+        self.bad = self.corrupt = 0
+        self.first_t = self.last_t = None
+        self.latencies = []
+
+    def on_packet(self, sender, data):
+        t = time.perf_counter()
+        decoded = self.session.decode_packet(data)
+        if decoded is None or self.t0 is None:
+            self.bad += 1
+            return
+        _, first, ir, red = decoded
+        n = len(ir)
+        if self.session.wire_format == WIRE_FORMAT_V1:
+            # No index on the wire: the test pattern carries its low 18 bits
+            first = self.next_index + ((int(ir[0]) - self.next_index) & VALUE_MASK)
+        expected = (first + np.arange(n)) & VALUE_MASK
+        if not (np.array_equal(ir, expected) and np.array_equal(red, expected ^ VALUE_MASK)):
+            self.corrupt += 1
+        self.next_index = first + n
+        self.packets += 1
+        self.received += n
+        self.highest = max(self.highest, first + n)
+        self.latencies.append(t - (self.t0 + (first + n) / self.rate))
+        if self.first_t is None:
+            self.first_t = t
+        self.last_t = t
+
+    def summary(self, fw_before, fw_after):
+        lost = self.highest - self.received
+        per_packet = self.received / self.packets if self.packets else 0
+        span = (self.last_t - self.first_t) if self.packets > 1 else 0
+        lat = np.array(self.latencies) * 1000 if self.latencies else np.zeros(1)
+        result = {
+            'rate': self.rate, 'format': self.session.wire_format, 'config': self.session.active_config,
+            'packets': self.packets, 'samples': self.received, 'samples_per_packet': per_packet,
+            'sustained_samples_per_s': self.received / span if span > 0 else 0.0,
+            'lost_samples': lost, 'sample_loss': lost / self.highest if self.highest else 0.0,
+            'bad_packets': self.bad, 'corrupt_packets': self.corrupt,
+            'latency_ms': {'min': lat.min(), 'p50': np.percentile(lat, 50),
+                           'p99': np.percentile(lat, 99), 'max': lat.max()},
+        }
+        if fw_before and fw_after:
+            sent = fw_after['notify_sent'] - fw_before['notify_sent']
+            result.update({
+                'fw_notify_sent': sent,
+                'fw_notify_failed': fw_after['notify_failed'] - fw_before['notify_failed'],
+                'fw_ring_overflows': fw_after['ring_overflows'] - fw_before['ring_overflows'],
+                'notification_loss': 1 - self.packets / sent if sent else 0.0,
+            })
+        return result
+
+# ================================================================
+# TEST RUN
+# ================================================================
+async def read_stats(client):
+    try:
+        return decode_stats(await client.read_gatt_char(STATS_UUID))
+    except Exception:
+        return None
+
+async def run_test(client, session, counter_box, rate, fmt, seconds, settings):
+    session.reset()
+    await session.configure_stream(client, settings)
+    counter = LinkCounter(session, rate)
+    counter_box[0] = counter
+    fw_before = await read_stats(client)
+
+    sent_at = time.perf_counter()
+    await client.write_gatt_char(COMMAND_UUID, bytes([ord('T'), fmt, rate >> 8, rate & 0xFF]), response=True)
+    ack = await client.read_gatt_char(COMMAND_UUID)
+    counter.t0 = (sent_at + time.perf_counter()) / 2
+    if len(ack) < 2 or ack[0] != ord('A'):
+        print("[ERROR] Firmware did not acknowledge the throughput test")
+        return None
+    session.wire_format = ack[1]
+
+    await asyncio.sleep(seconds)
+    await client.write_gatt_char(COMMAND_UUID, b'P')
+    await asyncio.sleep(DRAIN_SECONDS)
+    return counter.summary(fw_before, await read_stats(client))
+
+def print_result(r):
+    lat = r['latency_ms']
+    print(f"[LINK] {r['rate']:5d} Hz fmt {r['format']}: {r['sustained_samples_per_s']:7.0f} samples/s, "
+          f"{r['packets']} packets ({r['samples_per_packet']:.0f} samples each), "
+          f"loss {r['sample_loss'] * 100:.2f}% samples / {r.get('notification_loss', 0) * 100:.2f}% notifications, "
+          f"latency p50 {lat['p50']:.1f} ms p99 {lat['p99']:.1f} ms max {lat['max']:.1f} ms")
+    if r.get('fw_ring_overflows'):
+        print(f"        firmware ring overflowed {r['fw_ring_overflows']} samples – rate not sustainable")
+    if r['corrupt_packets'] or r['bad_packets']:
+        print(f"[ERROR] {r['corrupt_packets']} corrupt, {r['bad_packets']} undecodable packets")
+
+async def bench(args):
+    devices = await BleakScanner.discover(timeout=15.0)
+    device = next((d for d in devices if d.name == DEVICE_NAME), None)
+    if not device:
+        print("[ERROR] Device not found!")
+        return []
+
+    settings = {'batch_size': args.batch, 'chunk_ms': args.chunk_ms, 'pacing_ms': args.pacing_ms}
+    session = SensorSession()
+    counter_box = [None]
+    results = []
+    async with BleakClient(device.address) as client:
+        # One subscription for all tests; each test swaps in its own counter
+        await client.start_notify(DATA_UUID, lambda s, d: counter_box[0] and counter_box[0].on_packet(s, d))
+        for rate in args.rates:
+            r = await run_test(client, session, counter_box, rate, FORMATS[args.format], args.seconds, settings)
+            if r is None:
+                break
+            print_result(r)
+            results.append(r)
+    return results
+
+def main():
+    parser = argparse.ArgumentParser(description="BLE link throughput benchmark (firmware 'T' mode)")
+    parser.add_argument('--rates', nargs='+', type=int, default=TEST_RATES)
+    parser.add_argument('--format', choices=list(FORMATS), default='v2')
+    parser.add_argument('--seconds', type=float, default=TEST_SECONDS)
+    parser.add_argument('--batch', type=int, default=16, help="v1 samples per packet")
+    parser.add_argument('--chunk-ms', type=int, default=200)
+    parser.add_argument('--pacing-ms', type=int, default=0)
+    parser.add_argument('--out', default="link_results.json")
+    args = parser.parse_args()
+
+    results = asyncio.run(bench(args))
+    with open(args.out, "w") as f:
+        json.dump({'args': vars(args), 'results': results}, f, indent=2, default=float)
+    print(f"[LINK] Results written to {args.out}")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,141 @@
+# bench_processing.py
+# Benchmark for the host processing on synthetic recordings of realistic length:
+# per-stage wall time and peak memory of process_ppg_file(), per-update latency
+# of the incremental engine, written as JSON so runs can be compared.
+#
+# Usage: python bench_processing.py [--durations 1min 10min 1h 8h] [--loss random --loss-rate 0.01]
+#                                   [--archive session|csv]
+#                                   [--out bench_results.json] [--baseline old.json --tolerance 0.25]
+
+import argparse
+import json
+import os
+import platform
+import sys
+import tempfile
+import time
+import tracemalloc
+
+import numpy as np
+import scipy
+
+from filtering import process_ppg_file
+from session_archive import SESSION_SUFFIX, write_session
+from stream_engine import IncrementalEngine
+from synthetic_ppg import SAMPLE_RATE, LOSS_PATTERNS, synth_ppg, packet_keep_mask, recording_frame
+
+DURATIONS = {'1min': 60, '10min': 600, '1h': 3600, '8h': 8 * 3600}
+ENGINE_BLOCK_SEC = 1.0               # Incremental engine: samples per update
+
+def bench_file(path, fs):
+    """process_ppg_file() with stage times and the peak of traced allocations."""
+    stages = {}
+    tracemalloc.start()
+    t0 = time.perf_counter()
+    metrics = process_ppg_file(path, sample_rate=fs, verbose=False, stage_times=stages)
+    total = time.perf_counter() - t0
+    peak = tracemalloc.get_traced_memory()[1]
+    tracemalloc.stop()
+    return metrics, stages, total, peak
+
+def bench_engine(frame, fs):
+    """Feeds the recording to IncrementalEngine in ENGINE_BLOCK_SEC blocks, timing each update."""
+    engine = IncrementalEngine(sample_rate=fs)
+    idx, ir, red = frame['idx'].values, frame['IR'].values, frame['Red'].values
+    bounds = np.searchsorted(idx, np.arange(0, idx[-1] + 1, int(ENGINE_BLOCK_SEC * fs)))
+    latencies = []
+    for lo, hi in zip(bounds, np.append(bounds[1:], len(idx))):
+        t0 = time.perf_counter()
+        engine.feed(idx[lo:hi], ir[lo:hi], red[lo:hi])
+        metrics = engine.metrics()
+        latencies.append(time.perf_counter() - t0)
+    latencies = np.array(latencies)
+    return metrics, {'updates': len(latencies), 'mean_ms': latencies.mean() * 1000,
+                     'p99_ms': np.percentile(latencies, 99) * 1000, 'max_ms': latencies.max() * 1000}
+
+def run_case(name, args, workdir):
+    duration = DURATIONS[name]
+    ir, red, beats = synth_ppg(duration, fs=args.rate, hr_bpm=args.hr, hrv_ms=args.hrv,
+                               noise=args.noise, seed=args.seed)
+    keep = packet_keep_mask(len(ir), args.loss, args.loss_rate, seed=args.seed + 1)
+    frame = recording_frame(ir, red, keep)
+    if args.archive == 'session':
+        path = write_session(os.path.join(workdir, f"bench_{name}{SESSION_SUFFIX}"), frame['idx'].values,
+                             frame['IR'].values, frame['Red'].values, args.rate)
+    else:
+        path = os.path.join(workdir, f"bench_{name}.csv")
+        frame.to_csv(path, index=False)
+
+    metrics, stages, total, peak = bench_file(path, args.rate)
+    true_hr = 60.0 * args.rate / np.mean(np.diff(beats))
+    result = {
+        'case': name, 'duration_s': duration, 'sample_rate': args.rate,
+        'samples': len(ir), 'received': len(frame), 'loss': args.loss, 'loss_rate': args.loss_rate,
+        'archive': args.archive, 'file_mb': os.path.getsize(path) / 1e6,
+        'stages_s': stages, 'total_s': total, 'peak_mem_mb': peak / 1e6,
+        'true_hr': true_hr, 'mean_hr': metrics.get('mean_hr'),
+    }
+    if not args.skip_engine:
+        engine_metrics, result['engine'] = bench_engine(frame, args.rate)
+        result['engine_mean_hr'] = engine_metrics.get('mean_hr')
+    os.remove(path)
+    return result
+
+def check_baseline(results, baseline_path, tolerance):
+    """Regressions of total_s beyond tolerance (fraction) against a previous run."""
+    with open(baseline_path) as f:
+        baseline = {r['case']: r for r in json.load(f)['results']}
+    failures = []
+    for r in results:
+        old = baseline.get(r['case'])
+        if old and r['total_s'] > old['total_s'] * (1 + tolerance):
+            failures.append(f"{r['case']}: {r['total_s']:.2f}s vs {old['total_s']:.2f}s baseline")
+    return failures
+
+def main():
+    parser = argparse.ArgumentParser(description="Host processing benchmark on synthetic PPG")
+    parser.add_argument('--durations', nargs='+', default=list(DURATIONS), choices=list(DURATIONS))
+    parser.add_argument('--rate', type=int, default=SAMPLE_RATE)
+    parser.add_argument('--hr', type=float, default=72.0)
+    parser.add_argument('--hrv', type=float, default=40.0, help="RR spread, ms")
+    parser.add_argument('--noise', type=float, default=0.002, help="white noise, fraction of DC")
+    parser.add_argument('--loss', default='random', choices=LOSS_PATTERNS)
+    parser.add_argument('--loss-rate', type=float, default=0.01, help="fraction of packets lost")
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--archive', default='session', choices=['session', 'csv'], help="recording format fed to process_ppg_file()")
+    parser.add_argument('--skip-engine', action='store_true', help="only time process_ppg_file()")
+    parser.add_argument('--out', default="bench_results.json")
+    parser.add_argument('--baseline', help="previous results file to compare against")
+    parser.add_argument('--tolerance', type=float, default=0.25)
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory() as workdir:
+        for name in args.durations:
+            r = run_case(name, args, workdir)
+            results.append(r)
+            stages = "  ".join(f"{k} {v:.3f}" for k, v in r['stages_s'].items())
+            print(f"[BENCH] {name}: total {r['total_s']:.2f}s, peak {r['peak_mem_mb']:.0f} MB, "
+                  f"{r['archive']} {r['file_mb']:.1f} MB, "
+                  f"HR {r['mean_hr']} (true {r['true_hr']:.1f})")
+            print(f"        {stages}")
+            if 'engine' in r:
+                print(f"        engine: {r['engine']['mean_ms']:.2f} ms/update mean, "
+                      f"{r['engine']['max_ms']:.2f} ms max over {r['engine']['updates']} updates")
+
+    report = {
+        'python': platform.python_version(), 'numpy': np.__version__, 'scipy': scipy.__version__,
+        'machine': platform.machine(), 'args': vars(args), 'results': results,
+    }
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2, default=float)
+    print(f"[BENCH] Results written to {args.out}")
+
+    if args.baseline:
+        failures = check_baseline(results, args.baseline, args.tolerance)
+        for failure in failures:
+            print(f"[ERROR] Regression: {failure}")
+        sys.exit(1 if failures else 0)
+
+if __name__ == "__main__":
+    main()
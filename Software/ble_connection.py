@@ -2,65 +2,447 @@
 # Fixed: Prevents 'P' from being sent too soon after 'S'
 
 import asyncio
-import os
-import pandas as pd
+import json
 from bleak import BleakScanner, BleakClient
 import time
+import numpy as np
+
+from sample_ring import SampleRing, CsvArchive
+from session_archive import SAMPLES_PER_SEQ, SessionArchive
+from control_plane import plane
 
 SERVICE_UUID = "180D"
 COMMAND_UUID = "2A37"
 DATA_UUID = "2A38"
+CONFIG_UUID = "2A39"        # Write: versioned TLV config
+CONFIG_STATE_UUID = "2A3A"  # Read: [version][status] + active config TLVs
+STATS_UUID = "2A3B"         # Notify (1 s): firmware hot-path stats, see hot_path_stats.h
 
 SAMPLES_PER_PACKET = 16
 EXPECTED_PACKET_SIZE = 1 + SAMPLES_PER_PACKET * 8
 
+# Wire formats (must match wire_format.h in the firmware)
+WIRE_FORMAT_V1 = 1          # [seq] + 16 x (IR u32 BE, Red u32 BE)
+WIRE_FORMAT_V2_PACKED = 2   # v2 header + 18-bit IR/Red bitstream
+WIRE_FORMAT_V2_DELTA = 3    # v2 header + first sample u24 BE, then zig-zag varint deltas
+WIRE_FORMAT_METRICS = 0x10  # 'M' session: beat events + periodic summaries only
+ACK_RESUMED = ord('R')      # Third start-ack byte: a held session continued (index not reset)
+REQUESTED_WIRE_FORMAT = WIRE_FORMAT_V2_PACKED
+METRICS_ONLY = False        # True = on-device beat detection, no raw samples over BLE
+METRICS_PACKET_BEAT = 0x10      # [type][index u32 BE][rr_ms u16 BE]
+METRICS_PACKET_SUMMARY = 0x11   # [type][index u32 BE][hr x10][spo2 x10][rmssd x10][beats u8]
+V2_HEADER_SIZE = 11         # [fmt][seq][count][first sample index u32 BE][anchor micros u32 BE]
+SAMPLE_BITS = 18
+
+# On-device decimation: the sensor samples at SENSOR_RATE and the firmware
+# filters down to SENSOR_RATE / DECIMATION before sending (e.g. 800 / 4 = 200 Hz)
+SENSOR_RATE = 200           # 50, 100, 200, 400, 800, 1000 or 1600 Hz
+DECIMATION = 1              # 1 = off, up to 16
+DEFAULT_OUTPUT_RATE = 200   # What firmware without the config characteristic streams
+
+# Runtime config (must match config_protocol.h): name -> (tag, value bytes).
+# Only the keys in STREAM_CONFIG are sent; everything else keeps the firmware
+# defaults. Add e.g. 'led_brightness': 0x7F, 'chunk_ms': 100, 'pacing_ms': 5, or
+# 'power_mode': POWER_BURST, 'burst_ms': 3000 for the low-power duty-cycled mode
+# (the firmware sleeps between FIFO interrupts and sends 3 s of data at once).
+# 'store_forward': 1 keeps a v2 session acquiring into flash while the link is
+# down; after the reconnect below the gap is backfilled by absolute index.
+# 'contact_pause_s': 10 stops sending after 10 s off-finger or saturated (the
+# host sees a gap) and resumes once contact is back.
+CONFIG_VERSION = 1
+CONFIG_TAGS = {
+    'sensor_rate': (0x01, 2), 'decimation': (0x02, 1), 'pulse_width': (0x03, 2),
+    'led_brightness': (0x04, 1), 'batch_size': (0x05, 1), 'chunk_ms': (0x06, 2),
+    'pacing_ms': (0x07, 2), 'power_mode': (0x08, 1), 'burst_ms': (0x09, 2), 'buffer_ms': (0x0A, 2),
+    'store_forward': (0x0B, 1), 'contact_pause_s': (0x0C, 2), 'output_rate': (0x10, 2), 'chunk_samples': (0x11, 2),
+}
+POWER_CONTINUOUS = 0
+POWER_BURST = 1
+CONFIG_STATUS = {0: "ok", 1: "bad version", 2: "bad TLV", 3: "bad value", 4: "busy (streaming)"}
+STREAM_CONFIG = {'sensor_rate': SENSOR_RATE, 'decimation': DECIMATION}
+RECONNECT_ATTEMPTS = 10     # After a dropped link mid-stream (0 = give up immediately)
+
+SESSION_DIR = "sessions"
+ARCHIVE_SESSION = True      # Binary session archive, one .ppgs per session (session_archive.py)
 CSV_FILE = "latest_ppg_data.csv"
-CONNECTED_FLAG = "ble_connected.txt"
-START_FLAG = "start.txt"
-STOP_FLAG = "stop.txt"
-
-seq_values = []
-ir_values = []
-red_values = []
-last_saved = 0
-
-def notification_handler(sender, data):
-    global last_saved
-    if len(data) != EXPECTED_PACKET_SIZE:
-        print(f"[ERROR] Bad packet size: {len(data)}")
-        return
+ARCHIVE_CSV = False         # Also append the session to CSV_FILE (legacy text archive)
+ARCHIVE_PERIOD_SEC = 2.0
+METRICS_FILE = "latest_metrics.json"
+STATS_FILE = "latest_stats.json"
+TASK_NAMES = ("acquisition", "dsp", "ble")   # Stats order of the firmware threads (hot_path_stats.h)
+MIN_TEST_SECONDS = 30      # Stop requests before this are ignored
 
-    seq = data[0]
-    offset = 1
-    for _ in range(SAMPLES_PER_PACKET):
-        ir = int.from_bytes(data[offset:offset+4], 'big')
-        red = int.from_bytes(data[offset+4:offset+8], 'big')
-        seq_values.append(seq)
-        ir_values.append(ir)
-        red_values.append(red)
-        offset += 8
-
-    current = len(ir_values)
-    if current - last_saved >= 200:
-        df_chunk = pd.DataFrame({
-            'seq': seq_values[last_saved:current],
-            'IR': ir_values[last_saved:current],
-            'Red': red_values[last_saved:current]
-        })
-        mode = 'a' if os.path.exists(CSV_FILE) else 'w'
-        df_chunk.to_csv(CSV_FILE, mode=mode, header=(mode=='w'), index=False)
-        last_saved = current
-        print(f"[CSV] Saved {current} samples")
+# ================================================================
+# PAYLOAD DECODERS – (ir_array, red_array) or None
+# ================================================================
+# Each payload is decoded with a handful of whole-array NumPy operations instead
+# of a per-sample Python loop; the arrays are views or small temporaries that
+# SampleRing.write() copies straight into its preallocated slots.
+def decode_v2_packed(count, payload):
+    if len(payload) != (count * 2 * SAMPLE_BITS + 7) // 8:
+        print(f"[ERROR] Bad v2 packed payload: {len(payload)} bytes for {count} samples")
+        return None
+    # Two samples (four 18-bit fields, MSB first) fill exactly 9 bytes
+    groups = (count + 1) // 2
+    b = np.zeros(groups * 9, dtype=np.uint32)
+    b[:len(payload)] = np.frombuffer(payload, dtype=np.uint8)
+    b = b.reshape(-1, 9)
+    fields = np.empty((groups, 4), dtype=np.uint32)
+    fields[:, 0] = (b[:, 0] << 10) | (b[:, 1] << 2) | (b[:, 2] >> 6)
+    fields[:, 1] = ((b[:, 2] & 0x3F) << 12) | (b[:, 3] << 4) | (b[:, 4] >> 4)
+    fields[:, 2] = ((b[:, 4] & 0x0F) << 14) | (b[:, 5] << 6) | (b[:, 6] >> 2)
+    fields[:, 3] = ((b[:, 6] & 0x03) << 16) | (b[:, 7] << 8) | b[:, 8]
+    pairs = fields.reshape(-1, 2)[:count]
+    return pairs[:, 0], pairs[:, 1]
 
-async def start_ble_listener():
-    global last_saved
+def decode_v2_delta(count, payload):
+    if count == 0 or len(payload) < 6:
+        print(f"[ERROR] Bad v2 delta payload: {len(payload)} bytes")
+        return None
+    first = np.array([int.from_bytes(payload[0:3], 'big'), int.from_bytes(payload[3:6], 'big')], dtype=np.int64)
+    b = np.frombuffer(payload, dtype=np.uint8, offset=6).astype(np.int64)
+    ends = np.flatnonzero((b & 0x80) == 0)      # Last byte of each varint
+    b = b[:ends[-1] + 1] if len(ends) else b[:0]
+    if len(ends) != 2 * (count - 1):
+        print(f"[ERROR] Bad v2 delta payload: {len(ends)} deltas for {count} samples")
+        return None
+    if count == 1:
+        return first[:1], first[1:]
+    # Byte position within its varint -> 7-bit little-endian groups, summed per varint
+    starts = np.concatenate(([0], ends[:-1] + 1))
+    pos = np.arange(len(b)) - np.repeat(starts, ends - starts + 1)
+    zz = np.add.reduceat((b & 0x7F) << (7 * pos), starts)
+    deltas = ((zz >> 1) ^ -(zz & 1)).reshape(-1, 2)
+    samples = np.cumsum(np.vstack((first, deltas)), axis=0)
+    return samples[:, 0], samples[:, 1]
+
+
+def decode_stats(data):
+    """Firmware stats block (STATS_VERSION 1) -> dict, or None."""
+    if len(data) < 44 or data[0] != 1:
+        return None
+    u16 = lambda o: int.from_bytes(data[o:o+2], 'big')
+    u32 = lambda o: int.from_bytes(data[o:o+4], 'big')
+    return {
+        'window_ms': u16(1), 'loops': u32(3), 'loop_avg_us': u16(7), 'loop_max_us': u16(9),
+        'drains': u16(11), 'drain_avg_samples': u16(13) / 10, 'drain_max_samples': data[15],
+        'ring_now': u16(16), 'ring_high_water': u16(18),
+        'ring_overflows': u32(20), 'fifo_overflows': u32(24),
+        'notify_sent': u32(28), 'notify_failed': u32(32),
+        'tx_blocked': u32(36), 'tx_time_ms': u32(40),
+        'sleep_ms': u32(44) if len(data) >= 48 else None,
+        'contact_paused': u32(48) if len(data) >= 52 else None,     # Samples dropped on bad contact
+        # Threaded firmware build only (all zero otherwise): per-thread CPU share and stack use
+        'tasks': {name: {'busy_permille': u16(52 + 4 * i), 'stack_used': u16(54 + 4 * i)}
+                  for i, name in enumerate(TASK_NAMES)} if len(data) >= 66 else None,
+        'acq_wake_max_us': u16(64) if len(data) >= 66 else None,
+    }
+
+
+def encode_config(settings):
+    """[version] + one [tag][len][value BE] entry per setting."""
+    out = bytearray([CONFIG_VERSION])
+    for name, value in settings.items():
+        tag, size = CONFIG_TAGS[name]
+        out += bytes([tag, size]) + int(value).to_bytes(size, 'big')
+    return bytes(out)
+
+def decode_config_state(data):
+    """Returns (status, {name: value}) from the config state characteristic."""
+    if len(data) < 2 or data[0] != CONFIG_VERSION:
+        return None, {}
+    names = {tag: name for name, (tag, _) in CONFIG_TAGS.items()}
+    config, pos = {}, 2
+    while pos + 2 <= len(data):
+        tag, size = data[pos], data[pos + 1]
+        if tag in names:
+            config[names[tag]] = int.from_bytes(data[pos + 2:pos + 2 + size], 'big')
+        pos += 2 + size
+    return data[1], config
+
+
+# ================================================================
+# SENSOR SESSION – everything one device's connection needs
+# ================================================================
+class SensorSession:
+    """
+    Receive state for one sensor: negotiated format, config, v1 index state and
+    the sample ring the processor reads. The single-device listener below uses
+    the module-level `session`; multi_ingest.py creates one per wearable.
+    """
+
+    def __init__(self, device_id="", csv_file=CSV_FILE, metrics_file=METRICS_FILE, stats_file=STATS_FILE,
+                 session_dir=SESSION_DIR):
+        self.device_id = device_id
+        self.label = f"{device_id}: " if device_id else ""
+        self.metrics_file = metrics_file
+        self.stats_file = stats_file
+        # Decoded samples go straight into the ring; the processor and the
+        # archives read it with their own cursors
+        self.ring = SampleRing()
+        self.session_archive = SessionArchive(self.ring, session_dir, f"{device_id}_" if device_id else "")
+        self.csv_archive = CsvArchive(self.ring, csv_file)
+        self.on_metrics = None      # Metrics-only mode: callback(metrics) instead of metrics_file
+        self.reset()
+
+    def reset(self):
+        """New recording."""
+        self.restart_indices()
+        self.wire_format = WIRE_FORMAT_V1
+        self.resumed = False            # Last start ack: the firmware continued a held session
+        self.pending_packets = None     # Packets received while the format ack is still outstanding
+        self.output_rate = DEFAULT_OUTPUT_RATE
+        self.last_stats = None
+        self.active_config = {}         # Last config state reported by the firmware
+
+    def restart_indices(self):
+        """The firmware numbers samples from 0 again: new ring session (readers restart)."""
+        self.ring.reset()
+        self.beat_indices = []          # Metrics-only mode: beats since the last summary
+        self.last_anchor_us = None      # Firmware micros() of the newest packet's first sample (v2 only)
+        # v1 has only a wrapping u8 seq per chunk, so its sample index is estimated
+        self.v1_seq_last = None
+        self.v1_seq_base = 0
+        self.v1_seq_fill = 0
+
+    # --- Packets ---
+    def v1_sample_index(self, seq, count):
+        """Unwraps the u8 chunk seq and places the packet within its chunk (best effort)."""
+        if self.v1_seq_last is not None and seq != self.v1_seq_last:
+            if seq < self.v1_seq_last:
+                self.v1_seq_base += 256
+            self.v1_seq_fill = 0
+        self.v1_seq_last = seq
+        first = (self.v1_seq_base + seq) * self.active_config.get('chunk_samples', SAMPLES_PER_SEQ) + self.v1_seq_fill
+        self.v1_seq_fill += count
+        return first
+
+    def decode_v1(self, data):
+        expected = 1 + self.active_config.get('batch_size', SAMPLES_PER_PACKET) * 8
+        if len(data) != expected:
+            print(f"[ERROR] {self.label}Bad packet size: {len(data)}")
+            return None
+        seq = data[0]
+        pairs = np.frombuffer(data, dtype='>u4', offset=1).reshape(-1, 2)   # transmitChunk(): IR, Red u32 BE
+        return seq, self.v1_sample_index(seq, len(pairs)), pairs[:, 0], pairs[:, 1]
 
-    seq_values.clear()
-    ir_values.clear()
-    red_values.clear()
-    last_saved = 0
-    if os.path.exists(CSV_FILE):
-        os.remove(CSV_FILE)
+    def decode_packet(self, data):
+        """(seq, first_index, ir_array, red_array) or None."""
+        if self.wire_format == WIRE_FORMAT_V1:
+            return self.decode_v1(data)
+        if len(data) < V2_HEADER_SIZE or data[0] != self.wire_format:
+            print(f"[ERROR] {self.label}Unexpected packet header for format {self.wire_format}")
+            return None
+        seq, count = data[1], data[2]
+        first_index = int.from_bytes(data[3:7], 'big')
+        payload = data[V2_HEADER_SIZE:]
+        if self.wire_format == WIRE_FORMAT_V2_DELTA:
+            samples = decode_v2_delta(count, payload)
+        else:
+            samples = decode_v2_packed(count, payload)
+        if samples is None:
+            return None
+        self.last_anchor_us = int.from_bytes(data[7:11], 'big')
+        return (seq, first_index) + samples
+
+    def store_packet(self, data):
+        decoded = self.decode_packet(data)
+        if decoded is None:
+            return
+        seq, first_index, ir, red = decoded
+        self.ring.write(seq, first_index, ir, red)
+
+    def start_archives(self):
+        """New recording: archives restart their cursors (call with reset())."""
+        self.session_archive.start()
+        self.csv_archive.start()
+
+    def flush_archives(self):
+        """Appends what arrived since the last flush; returns the samples written."""
+        saved = 0
+        if ARCHIVE_SESSION:
+            saved = self.session_archive.flush()
+        if ARCHIVE_CSV:
+            saved = max(saved, self.csv_archive.flush())
+        return saved
+
+    async def archive_task(self):
+        """
+        Copies the ring to the archives in the background (file I/O off the event
+        loop). Started once the stream is negotiated, so the session header gets
+        the rate and config actually in use.
+        """
+        if ARCHIVE_SESSION:
+            path = await asyncio.to_thread(self.session_archive.begin, self.output_rate,
+                                           self.active_config, self.wire_format)
+            print(f"[ARCHIVE] {self.label}Recording to {path}")
+        while True:
+            await asyncio.sleep(ARCHIVE_PERIOD_SEC)
+            if await asyncio.to_thread(self.flush_archives):
+                saved = self.session_archive.saved if ARCHIVE_SESSION else self.csv_archive.saved
+                print(f"[ARCHIVE] {self.label}Saved {saved} samples")
+
+    def store_metrics_packet(self, data):
+        """Metrics-only mode: collects beats and publishes each on-device summary."""
+        if len(data) == 7 and data[0] == METRICS_PACKET_BEAT:
+            self.beat_indices.append(int.from_bytes(data[1:5], 'big'))
+            return
+        if len(data) != 12 or data[0] != METRICS_PACKET_SUMMARY:
+            print(f"[ERROR] {self.label}Bad metrics packet: {len(data)} bytes")
+            return
+        hr_x10 = int.from_bytes(data[5:7], 'big')
+        spo2_x10 = int.from_bytes(data[7:9], 'big')
+        rmssd_x10 = int.from_bytes(data[9:11], 'big')
+        metrics = {
+            'mean_hr': hr_x10 / 10 if hr_x10 else None,
+            'rmssd': rmssd_x10 / 10 if rmssd_x10 else None,    # 0 until the window has two RR intervals
+            'sdnn': None,
+            'spo2': spo2_x10 / 10 if spo2_x10 else None,
+            'perfusion_index_x10': None,
+            'respiration_rate': None,
+            'peaks': self.beat_indices      # Only the beats of this summary window
+        }
+        self.beat_indices = []
+        if self.on_metrics is not None:
+            self.on_metrics(metrics)
+        else:
+            with open(self.metrics_file, "w") as f:
+                json.dump(metrics, f)
+            plane.publish('metrics', metrics)
+        print(f"[METRICS] {self.label}HR {metrics['mean_hr']} bpm, SpO2 {metrics['spo2']}%, {data[11]} beats")
+
+    def stats_handler(self, sender, data):
+        stats = decode_stats(data)
+        if stats is None:
+            return
+        with open(self.stats_file, "w") as f:
+            json.dump(stats, f)
+        prev = self.last_stats or {}
+        lost = (stats['ring_overflows'] - prev.get('ring_overflows', 0),
+                stats['fifo_overflows'] - prev.get('fifo_overflows', 0))
+        if any(lost):
+            print(f"[STATS] {self.label}Dropped samples: ring {lost[0]}, FIFO {lost[1]} "
+                  f"(loop max {stats['loop_max_us']} us, ring peak {stats['ring_high_water']})")
+        self.last_stats = stats
+
+    def notification_handler(self, sender, data):
+        if self.pending_packets is not None:
+            self.pending_packets.append(bytes(data))
+            return
+        if self.wire_format == WIRE_FORMAT_METRICS:
+            self.store_metrics_packet(data)
+            return
+        self.store_packet(data)
+
+    # --- Link ---
+    async def configure_stream(self, client, settings=None):
+        """
+        Writes settings (default STREAM_CONFIG) to the config characteristic and
+        reads back the config the firmware actually uses. Firmware without the
+        characteristic keeps its compiled-in defaults (v1 packets at 200 Hz).
+        """
+        self.output_rate = DEFAULT_OUTPUT_RATE
+        self.active_config = {}
+        try:
+            await client.write_gatt_char(CONFIG_UUID, encode_config(settings or STREAM_CONFIG), response=True)
+            status, self.active_config = decode_config_state(await client.read_gatt_char(CONFIG_STATE_UUID))
+        except Exception as e:
+            print(f"[DEBUG] {self.label}No runtime config on this firmware ({e}) – using defaults")
+            return self.output_rate
+        if status != 0:
+            print(f"[ERROR] {self.label}Config rejected: {CONFIG_STATUS.get(status, status)}")
+        self.output_rate = self.active_config.get('output_rate', DEFAULT_OUTPUT_RATE)
+        print(f"[DEBUG] {self.label}Active config: {self.active_config}")
+        return self.output_rate
+
+    async def negotiate_and_start(self, client, reconnecting=False):
+        """
+        Sends {'S', format} (or 'M' for metrics-only). Firmware that understands it
+        answers {'A', format} on the command characteristic, plus ACK_RESUMED when
+        it continued a held session; anything else means legacy v1 packets. A
+        reconnect that was not resumed starts a new recording before the queued
+        packets are stored, since the firmware's index starts again at 0.
+        """
+        self.pending_packets = []
+        if METRICS_ONLY:
+            await client.write_gatt_char(COMMAND_UUID, b'M')
+        else:
+            await client.write_gatt_char(COMMAND_UUID, bytes([ord('S'), REQUESTED_WIRE_FORMAT]))
+        ack = await client.read_gatt_char(COMMAND_UUID)
+        if len(ack) >= 2 and ack[0] == ord('A'):
+            self.wire_format = ack[1]
+        else:
+            self.wire_format = WIRE_FORMAT_V1
+        self.resumed = len(ack) >= 3 and ack[0] == ord('A') and ack[2] == ACK_RESUMED
+        if reconnecting and not self.resumed:
+            await self.restart_recording()
+        if METRICS_ONLY and self.wire_format != WIRE_FORMAT_METRICS:
+            print(f"[ERROR] {self.label}Firmware does not support metrics-only mode")
+
+        queued, self.pending_packets = self.pending_packets, None
+        for data in queued:
+            self.notification_handler(None, data)
+        return self.wire_format
+
+    async def subscribe(self, client):
+        await client.start_notify(DATA_UUID, self.notification_handler)
+        try:
+            await client.start_notify(STATS_UUID, self.stats_handler)
+        except Exception:
+            print(f"[DEBUG] {self.label}Firmware has no stats characteristic")
+
+    async def restart_recording(self):
+        """
+        Reconnected to a fresh firmware session: flushes what the archive has
+        not saved yet, restarts the ring (the engine starts over) and opens a new
+        archive segment, so no sample index is recorded twice.
+        """
+        await asyncio.to_thread(self.flush_archives)
+        self.restart_indices()
+        if ARCHIVE_SESSION and self.session_archive.path is not None:
+            self.session_archive.start()
+            path = await asyncio.to_thread(self.session_archive.begin, self.output_rate,
+                                           self.active_config, self.wire_format)
+            print(f"[ARCHIVE] {self.label}Session restarted by the firmware – recording to {path}")
+
+    async def reconnect(self, address):
+        """
+        Re-establishes a dropped link and repeats the start handshake. Firmware
+        holding the session (store-and-forward) treats the 'S' as a resume and
+        backfills the samples stored while disconnected; otherwise the recording
+        restarts (see restart_recording()).
+        """
+        for attempt in range(1, RECONNECT_ATTEMPTS + 1):
+            client = BleakClient(address)
+            try:
+                await client.connect(timeout=20.0)
+                await self.subscribe(client)
+                await self.configure_stream(client)
+                fmt = await self.negotiate_and_start(client, reconnecting=True)
+                print(f"[SUCCESS] {self.label}Reconnected after {attempt} attempt(s) (wire format {fmt})")
+                return client
+            except Exception as e:
+                print(f"[ERROR] {self.label}Reconnect attempt {attempt} failed: {e}")
+                await asyncio.sleep(2)
+        return None
+
+# Single-device mode (main_engine / GUI)
+session = SensorSession()
+sample_ring = session.ring
+
+def current_output_rate():
+    """Sample rate of the stream being recorded (sensor rate / decimation)."""
+    return session.output_rate
+
+async def start_ble_listener():
+    """
+    Single-device listener driven by the control plane: publishes 'connected',
+    starts on 'start' and stops on 'stop' (not before MIN_TEST_SECONDS).
+    """
+    session.reset()
+    session.start_archives()
+    archiver = None
+    events, unsubscribe = plane.asyncio_events(asyncio.get_running_loop(), 'start', 'stop')
 
     print("Scanning for PPG_Sensor...")
     devices = await BleakScanner.discover(timeout=15.0)
@@ -73,50 +455,57 @@ async def start_ble_listener():
     try:
         await client.connect(timeout=20.0)
         print("[SUCCESS] BLE Connected")
-        open(CONNECTED_FLAG, "w").close()
+        plane.publish('connected', True)
 
-        await client.start_notify(DATA_UUID, notification_handler)
+        await session.subscribe(client)
 
-        print("[DEBUG] Waiting for start.txt...")
-        while not os.path.exists(START_FLAG):
-            await asyncio.sleep(0.5)
-        os.remove(START_FLAG)
+        print("[DEBUG] Waiting for start...")
+        await events['start'].wait()
+        events['stop'].clear()
         start_time = time.time()
-        await client.write_gatt_char(COMMAND_UUID, b'S')
-        print("[SUCCESS] Sent 'S' – streaming started")
+        await session.configure_stream(client)
+        fmt = await session.negotiate_and_start(client)
+        print(f"[SUCCESS] Sent 'S' – streaming started (wire format {fmt})")
+        if ARCHIVE_SESSION or ARCHIVE_CSV:
+            archiver = asyncio.create_task(session.archive_task())
 
-        # Wait for stop.txt, but ignore it for the first 30 seconds
-        print("[DEBUG] Streaming – waiting for stop.txt (minimum 30s test)...")
+        # Wait for stop, but ignore it for the first MIN_TEST_SECONDS; the
+        # timeout only paces the link check
+        print(f"[DEBUG] Streaming – waiting for stop (minimum {MIN_TEST_SECONDS}s test)...")
         while True:
-            if os.path.exists(STOP_FLAG):
-                elapsed = time.time() - start_time
-                if elapsed >= 30:  # Minimum test duration
-                    os.remove(STOP_FLAG)
-                    await client.write_gatt_char(COMMAND_UUID, b'P')
-                    print("[SUCCESS] Sent 'P' – streaming stopped")
+            if not client.is_connected:
+                print("[ERROR] BLE link lost – reconnecting")
+                plane.publish('connected', False)
+                client = await session.reconnect(device.address)
+                if client is None:
                     break
-                else:
-                    print(f"[DEBUG] Stop requested but only {elapsed:.1f}s elapsed – ignoring (min 30s)")
-                    os.remove(STOP_FLAG)  # Remove premature flag
-            await asyncio.sleep(0.5)
+                plane.publish('connected', True)
+            try:
+                await asyncio.wait_for(events['stop'].wait(), 0.5)
+            except asyncio.TimeoutError:
+                continue
+            events['stop'].clear()
+            elapsed = time.time() - start_time
+            if elapsed >= MIN_TEST_SECONDS:
+                await client.write_gatt_char(COMMAND_UUID, b'P')
+                print("[SUCCESS] Sent 'P' – streaming stopped")
+                break
+            print(f"[DEBUG] Stop requested but only {elapsed:.1f}s elapsed – ignoring (min {MIN_TEST_SECONDS}s)")
 
         # Final save
-        if last_saved < len(ir_values):
-            df_final = pd.DataFrame({
-                'seq': seq_values[last_saved:],
-                'IR': ir_values[last_saved:],
-                'Red': red_values[last_saved:]
-            })
-            df_final.to_csv(CSV_FILE, mode='a', header=not os.path.exists(CSV_FILE), index=False)
-            print(f"[CSV] Final save: {len(df_final)} samples")
+        if archiver is not None:
+            archiver.cancel()
+            saved = await asyncio.to_thread(session.flush_archives)
+            print(f"[ARCHIVE] Final save: {saved} samples")
 
     except Exception as e:
         print(f"[ERROR] BLE error: {e}")
     finally:
-        await client.disconnect()
-        if os.path.exists(CONNECTED_FLAG):
-            os.remove(CONNECTED_FLAG)
+        if client is not None:
+            await client.disconnect()
+        unsubscribe()
+        plane.publish('connected', False)
         print("[DEBUG] BLE disconnected cleanly")
 
 def start_ble_listener_thread():
-    asyncio.run(start_ble_listener())
\ No newline at end of file
+    asyncio.run(start_ble_listener())
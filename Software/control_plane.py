@@ -0,0 +1,209 @@
+# control_plane.py
+# Event channel between the BLE listener / replay, the processing thread and the
+# GUI: in-process callbacks, plus a localhost socket for the Streamlit process.
+# Replaces the polled start.txt / stop.txt / ble_connected.txt flags and the GUI
+# re-reading latest_metrics.json.
+#
+# Events: 'start', 'stop' (GUI -> listener), 'connected' (bool), 'metrics' (dict),
+#         'beat' ({index, rr_ms, lag_ms}, as each beat is confirmed),
+#         'waveform' ({t0, dt, lo, hi}: min/max envelope of the new bandpassed IR).
+# Wire format on the socket: one JSON object per line, {"event": ..., "value": ...}.
+
+import asyncio
+import json
+from collections import deque
+import socket
+import threading
+import time
+
+CONTROL_HOST = "127.0.0.1"
+CONTROL_PORT = 8765
+RETAINED_EVENTS = ('connected', 'metrics')   # Latest value is replayed to new subscribers/clients
+RECONNECT_SEC = 1.0
+WAVEFORM_BUFFER = 3000                       # Envelope points a client keeps (60 s at 50 points/s)
+METRICS_BUFFER = 3600                        # Metrics updates a client keeps (1 h at one per second)
+
+def encode_event(event, value=None):
+    return (json.dumps({'event': event, 'value': value}, default=float) + "\n").encode()
+
+# ================================================================
+# BROKER (lives in the main_engine / test_main_engine process)
+# ================================================================
+class ControlPlane:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.subscribers = []
+        self.clients = []
+        self.retained = {}
+        self.server = None
+
+    def subscribe(self, callback):
+        """callback(event, value) runs on the publishing thread; returns an unsubscribe function."""
+        with self.lock:
+            self.subscribers.append(callback)
+            retained = list(self.retained.items())
+        for event, value in retained:
+            callback(event, value)
+        return lambda: self._unsubscribe(callback)
+
+    def _unsubscribe(self, callback):
+        with self.lock:
+            if callback in self.subscribers:
+                self.subscribers.remove(callback)
+
+    def publish(self, event, value=None):
+        line = encode_event(event, value)
+        with self.lock:
+            if event in RETAINED_EVENTS:
+                self.retained[event] = value
+            subscribers = list(self.subscribers)
+            clients = list(self.clients)
+        for callback in subscribers:
+            callback(event, value)
+        for conn in clients:
+            try:
+                conn.sendall(line)
+            except OSError:
+                self._drop(conn)
+
+    def asyncio_events(self, loop, *names):
+        """
+        asyncio.Event per name, set (thread-safely) when that event is published.
+        Returns (events, unsubscribe); clear an event to wait for the next one.
+        """
+        events = {name: asyncio.Event() for name in names}
+
+        def on_event(event, value):
+            if event in events and event not in RETAINED_EVENTS:
+                loop.call_soon_threadsafe(events[event].set)
+        return events, self.subscribe(on_event)
+
+    # --- Socket side ---
+    def serve(self, host=CONTROL_HOST, port=CONTROL_PORT):
+        self.server = socket.create_server((host, port))
+        threading.Thread(target=self._accept, daemon=True).start()
+
+    def _accept(self):
+        while True:
+            conn, _ = self.server.accept()
+            conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            with self.lock:
+                self.clients.append(conn)
+                retained = list(self.retained.items())
+            try:
+                for event, value in retained:
+                    conn.sendall(encode_event(event, value))
+            except OSError:
+                self._drop(conn)
+                continue
+            threading.Thread(target=self._read_client, args=(conn,), daemon=True).start()
+
+    def _read_client(self, conn):
+        try:
+            for line in conn.makefile('r'):
+                msg = json.loads(line)
+                self.publish(msg['event'], msg.get('value'))
+        except (OSError, ValueError, KeyError):
+            pass
+        self._drop(conn)
+
+    def _drop(self, conn):
+        with self.lock:
+            if conn in self.clients:
+                self.clients.remove(conn)
+        conn.close()
+
+# Process-wide broker
+plane = ControlPlane()
+
+# ================================================================
+# CLIENT (GUI process)
+# ================================================================
+class ControlClient:
+    """
+    Keeps a connection to the broker (reconnecting in the background), tracks the
+    retained state and lets the GUI block until something changes. Metrics and
+    the waveform envelope are also kept as streams with a running count, so a
+    reader can take only what arrived since its last cursor (read_metrics() /
+    read_waveform()).
+    """
+
+    def __init__(self, host=CONTROL_HOST, port=CONTROL_PORT):
+        self.address = (host, port)
+        self.connected = False      # Sensor link state as reported by the listener
+        self.metrics = {}
+        self.last_beat = None
+        self.metrics_log = deque(maxlen=METRICS_BUFFER)
+        self.metrics_count = 0
+        self.waveform = deque(maxlen=WAVEFORM_BUFFER)   # (t, lo, hi)
+        self.waveform_count = 0
+        self.sock = None
+        self.changed = threading.Condition()
+        self.version = 0
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def send(self, event, value=None):
+        sock = self.sock
+        if sock is None:
+            return False
+        try:
+            sock.sendall(encode_event(event, value))
+            return True
+        except OSError:
+            return False
+
+    def wait_update(self, timeout):
+        """Returns True as soon as an event arrives, False after timeout."""
+        with self.changed:
+            seen = self.version
+            return self.changed.wait_for(lambda: self.version != seen, timeout)
+
+    def read_metrics(self, cursor):
+        """(metrics dicts pushed since cursor, new cursor); cursor 0 = everything still buffered."""
+        with self.changed:
+            return self._since(self.metrics_log, self.metrics_count, cursor)
+
+    def read_waveform(self, cursor):
+        """((t, lo, hi) envelope points since cursor, new cursor)."""
+        with self.changed:
+            return self._since(self.waveform, self.waveform_count, cursor)
+
+    @staticmethod
+    def _since(buffer, count, cursor):
+        new = min(count - cursor, len(buffer))
+        return list(buffer)[len(buffer) - new:] if new > 0 else [], count
+
+    def _run(self):
+        while True:
+            try:
+                sock = socket.create_connection(self.address)
+                sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                self.sock = sock
+                for line in sock.makefile('r'):
+                    msg = json.loads(line)
+                    self._apply(msg['event'], msg.get('value'))
+            except (OSError, ValueError, KeyError):
+                pass
+            self.sock = None
+            self._apply('connected', False)
+            time.sleep(RECONNECT_SEC)
+
+    def _apply(self, event, value):
+        if event == 'beat':
+            self.last_beat = value  # Not a GUI change: the plots follow 'metrics'
+            return
+        with self.changed:
+            if event == 'waveform':
+                # Streamed at the engine's poll rate; readers pick it up on their own tick
+                t0, dt = value['t0'], value['dt']
+                self.waveform.extend((t0 + k * dt, lo, hi) for k, (lo, hi) in enumerate(zip(value['lo'], value['hi'])))
+                self.waveform_count += len(value['lo'])
+                return
+            if event == 'connected':
+                self.connected = bool(value)
+            elif event == 'metrics':
+                self.metrics = value or {}
+                self.metrics_log.append(self.metrics)
+                self.metrics_count += 1
+            self.version += 1
+            self.changed.notify_all()
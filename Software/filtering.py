@@ -1,17 +1,22 @@
 # filtering.py
 # Modular processor with additional metrics: SDNN, perfusion, respiration
 
+import time
+from functools import lru_cache
 import numpy as np
 import matplotlib.pyplot as plt
-from scipy.signal import butter, sosfiltfilt, find_peaks
-from scipy.interpolate import interp1d
+from scipy.signal import butter, sosfilt, sosfilt_zi, sosfiltfilt, sosfreqz, find_peaks
+from scipy.interpolate import CubicSpline
 import pandas as pd
 
+from session_archive import SessionFile, is_session_archive, legacy_sample_index
+from signal_quality import assess, summarize
+
 # ================================================================
 # TUNABLE CONSTANTS
 # ================================================================
 SAMPLE_RATE = 200
-BATCH_SIZE = 40                      
+GAP_CONTEXT_SAMPLES = 4              # Received samples on each side of a gap the interpolating spline uses
 
 TRIM_START_SECONDS = 1.0             # Remove startup artifact
 TRIM_END_SECONDS = 2.0               # Remove noisy end
@@ -29,54 +34,135 @@ RR_LOWER_FACTOR = 0.7
 RR_UPPER_FACTOR = 1.5
 
 SPO2_DELAY_SEC = 0.02
+SPO2_LOWPASS = 0.5                   # AC/DC split in the SpO2 ratio
+
+BEAT_TIMING_HZ = 2.0                 # Causal mode: bandpass group delay taken at this frequency (systolic upstroke)
 
 # Set to True when running standalone, False when called from GUI
 PRODUCE_GRAPHS = False
 
+# ================================================================
+# FILTER DESIGN AND CAUSAL STREAMING FILTERS
+# ================================================================
+@lru_cache(maxsize=None)
+def bandpass_sos(sample_rate):
+    """BANDPASS_ORDER Butterworth, BANDPASS_LOW–BANDPASS_HIGH Hz; designed once per rate."""
+    return butter(BANDPASS_ORDER, [BANDPASS_LOW, BANDPASS_HIGH], 'band', fs=sample_rate, output='sos')
+
+@lru_cache(maxsize=None)
+def lowpass_sos(sample_rate, cutoff=SPO2_LOWPASS):
+    return butter(4, cutoff, 'low', fs=sample_rate, output='sos')
+
+def group_delay_samples(sos, freq_hz, sample_rate):
+    """Group delay of a causal SOS filter at freq_hz, in samples."""
+    w = 2 * np.pi * freq_hz / sample_rate * np.array([0.99, 1.01])
+    _, h = sosfreqz(sos, worN=w)
+    phase = np.unwrap(np.angle(h))
+    return float(-(phase[1] - phase[0]) / (w[1] - w[0]))
+
+class CausalFilter:
+    """
+    sosfilt with carried state, for one or more channels (columns). The state
+    starts at the steady state for the first sample, so a DC offset does not
+    ring through the filter. delay is the group delay at BEAT_TIMING_HZ, which
+    callers subtract from event times to line them up with the zero-phase path.
+    """
+
+    def __init__(self, sos, sample_rate, timing_hz=BEAT_TIMING_HZ):
+        self.sos = sos
+        self.zi_unit = sosfilt_zi(sos)
+        self.delay = group_delay_samples(sos, timing_hz, sample_rate)
+        self.zi = None
+
+    def reset(self):
+        self.zi = None
+
+    def process(self, x):
+        x = np.asarray(x, dtype=float)
+        if self.zi is None:
+            x0 = x[0]
+            self.zi = self.zi_unit[:, :, None] * np.atleast_1d(x0)[None, None, :] if x.ndim > 1 \
+                else self.zi_unit * x0
+        y, self.zi = sosfilt(self.sos, x, axis=0, zi=self.zi)
+        return y
+
 # ================================================================
 # MAIN PROCESSING FUNCTION
 # ================================================================
-def process_ppg_file(filename: str):
+def process_ppg_file(filename: str, sample_rate: int = SAMPLE_RATE, verbose: bool = True, stage_times: dict = None,
+                     causal: bool = False, gate: bool = True):
     """
-    Full Pan-Tompkins processing on a PPG CSV file with seq, IR, Red columns.
+    Full Pan-Tompkins processing on a PPG CSV file with seq, IR, Red (and, from
+    v2 firmware, idx = absolute sample index) columns, or on a binary session
+    archive (session_archive.py, memory-mapped).
+    sample_rate is the stream's output rate (sensor rate / on-device decimation);
+    a session archive records its own, which takes precedence.
+    verbose=False silences the progress prints; if stage_times is a dict it gets
+    the wall time of each stage in seconds (see bench_processing.py).
+    causal=True filters forward only, like the streaming engine, and moves the
+    peaks back by the bandpass group delay; the default zero-phase path is the
+    reference for final reports.
+    gate=True runs the signal-quality index (signal_quality.py) first: if no
+    window is usable nothing else runs; otherwise beats, RR intervals and the
+    amplitude metrics only come from the usable windows. The result's 'quality'
+    has the good fraction and the rejected windows.
     Returns dictionary of metrics and (optionally) shows detailed graphs.
     """
+    log = print if verbose else (lambda *args, **kwargs: None)
+    clock = [time.perf_counter()]
+
+    def stage(name):
+        if stage_times is not None:
+            now = time.perf_counter()
+            stage_times[name] = stage_times.get(name, 0.0) + now - clock[0]
+            clock[0] = now
+
     # --- Load data ---
-    df = pd.read_csv(filename)
-    seq = df['seq'].values.astype(int)
-    ir_raw = df['IR'].values.astype(float)
-    red_raw = df['Red'].values.astype(float)
+    if is_session_archive(filename):
+        archive = SessionFile(filename)
+        sample_rate = archive.sample_rate or sample_rate
+        idx = archive.idx
+        ir_raw = archive.ir.astype(float)
+        red_raw = archive.red.astype(float)
+    else:
+        df = pd.read_csv(filename)
+        ir_raw = df['IR'].values.astype(float)
+        red_raw = df['Red'].values.astype(float)
+        if 'idx' in df.columns:
+            idx = df['idx'].values.astype(np.int64)
+        else:
+            idx = legacy_sample_index(df['seq'].values)
+    received = len(idx)
+    stage('load')
 
-    # --- Gap reconstruction using sequence number ---
-    max_seq = seq.max()
-    true_total_packets = max_seq + 1
-    total_samples = true_total_packets * BATCH_SIZE
+    # --- Gap reconstruction using absolute sample index ---
+    idx = idx - idx.min()
+    total_samples = int(idx.max()) + 1
 
-    print(f"Max seq: {max_seq} → {true_total_packets} packets attempted")
-    print(f"True timeline: {total_samples} samples = {total_samples / SAMPLE_RATE:.1f} seconds")
+    log(f"Received {received} samples, {total_samples - received} missing")
+    log(f"True timeline: {total_samples} samples = {total_samples / sample_rate:.1f} seconds")
 
     ir_full = np.full(total_samples, np.nan)
     red_full = np.full(total_samples, np.nan)
-
-    for i in range(len(df)):
-        s = seq[i]
-        sample_in_packet = i % BATCH_SIZE
-        idx = s * BATCH_SIZE + sample_in_packet
-        if idx < total_samples:
-            ir_full[idx] = ir_raw[i]
-            red_full[idx] = red_raw[i]
-
-    t_full = np.arange(total_samples) / SAMPLE_RATE
-
-    # Interpolate missing packets
-    valid = ~np.isnan(ir_full)
-    interp_ir = interp1d(np.arange(total_samples)[valid], ir_full[valid],
-                         kind='cubic', bounds_error=False, fill_value='extrapolate')
-    ir_fixed = interp_ir(np.arange(total_samples))
-
-    interp_red = interp1d(np.arange(total_samples)[valid], red_full[valid],
-                          kind='cubic', bounds_error=False, fill_value='extrapolate')
-    red_fixed = interp_red(np.arange(total_samples))
+    ir_full[idx] = ir_raw
+    red_full[idx] = red_raw
+
+    t_full = np.arange(total_samples) / sample_rate
+
+    # Interpolate missing packets: one joint IR/Red cubic spline through the
+    # received samples next to the gaps, evaluated only inside the gaps
+    ir_fixed = ir_full.copy()
+    red_fixed = red_full.copy()
+    missing = np.flatnonzero(np.isnan(ir_full))
+    if len(missing) > 0:
+        context = (missing[:, None] + np.arange(-GAP_CONTEXT_SAMPLES, GAP_CONTEXT_SAMPLES + 1)).ravel()
+        context = context[(context >= 0) & (context < total_samples)]
+        knots = np.unique(context[~np.isnan(ir_full[context])])
+        spline = CubicSpline(knots, np.column_stack((ir_full[knots], red_full[knots])), axis=0)
+        filled = spline(missing)
+        ir_fixed[missing] = filled[:, 0]
+        red_fixed[missing] = filled[:, 1]
+    stage('gap_fill')
 
     if PRODUCE_GRAPHS:
         plt.figure(figsize=(15, 5))
@@ -91,14 +177,14 @@ def process_ppg_file(filename: str):
         plt.show()
 
     # --- Trim startup and end noise ---
-    trim_start = int(TRIM_START_SECONDS * SAMPLE_RATE)
-    trim_end = int(TRIM_END_SECONDS * SAMPLE_RATE)
+    trim_start = int(TRIM_START_SECONDS * sample_rate)
+    trim_end = int(TRIM_END_SECONDS * sample_rate)
 
     ir_trim = ir_fixed[trim_start:-trim_end] if trim_end > 0 else ir_fixed[trim_start:]
     red_trim = red_fixed[trim_start:-trim_end] if trim_end > 0 else red_fixed[trim_start:]
-    t_trim = np.arange(len(ir_trim)) / SAMPLE_RATE
+    t_trim = np.arange(len(ir_trim)) / sample_rate
 
-    print(f"After trimming: {len(ir_trim)} samples = {len(ir_trim)/SAMPLE_RATE:.2f} seconds")
+    log(f"After trimming: {len(ir_trim)} samples = {len(ir_trim)/sample_rate:.2f} seconds")
 
     if PRODUCE_GRAPHS:
         plt.figure(figsize=(15, 5))
@@ -110,6 +196,23 @@ def process_ppg_file(filename: str):
         plt.tight_layout()
         plt.show()
 
+    stage('trim')
+
+    # --- Signal quality gate ---
+    sos = bandpass_sos(sample_rate)
+    good = np.ones(len(ir_trim), dtype=bool)
+    quality = None
+    if gate:
+        good, windows = assess(ir_trim, red_trim, sample_rate, sos)
+        quality = summarize(windows, sample_rate)
+        log(f"Signal quality: {quality['good_fraction'] * 100:.0f}% usable, "
+            f"{len(quality['rejected'])} of {len(windows)} windows rejected")
+        stage('quality')
+        if not good.any():
+            log("No usable signal (off-finger, saturated or moving) – skipping processing")
+            return {'mean_hr': None, 'rmssd': None, 'sdnn': None, 'spo2': None,
+                    'perfusion_index_x10': None, 'respiration_rate': None, 'peaks': [], 'quality': quality}
+
     # --- AC component (zero-mean) ---
     ir_ac = ir_trim - np.mean(ir_trim)
 
@@ -126,10 +229,12 @@ def process_ppg_file(filename: str):
 
     # --- Bandpass filter ---
     def bandpass_filter(sig):
-        sos = butter(BANDPASS_ORDER, [BANDPASS_LOW, BANDPASS_HIGH], 'band', fs=SAMPLE_RATE, output='sos')
+        if causal:
+            return CausalFilter(sos, sample_rate).process(sig)
         return sosfiltfilt(sos, sig)
 
     ir_bp = bandpass_filter(ir_ac)
+    stage('bandpass')
 
     if PRODUCE_GRAPHS:
         plt.figure(figsize=(15, 5))
@@ -170,9 +275,10 @@ def process_ppg_file(filename: str):
         plt.show()
 
     # --- Moving integration ---
-    win = int(INTEGRATION_WINDOW_SEC * SAMPLE_RATE)
+    win = int(INTEGRATION_WINDOW_SEC * sample_rate)
     kernel = np.ones(win) / win
     integrated = np.convolve(squared, kernel, mode='same')
+    stage('integration')
 
     if PRODUCE_GRAPHS:
         plt.figure(figsize=(15, 5))
@@ -185,11 +291,17 @@ def process_ppg_file(filename: str):
         plt.show()
 
     # --- Peak detection ---
-    min_dist = int(MIN_PEAK_DIST_SEC * SAMPLE_RATE)
+    min_dist = int(MIN_PEAK_DIST_SEC * sample_rate)
     peaks, _ = find_peaks(integrated,
                           distance=min_dist,
                           height=PEAK_HEIGHT_FACTOR * integrated.max(),
                           prominence=PEAK_PROMINENCE_FACTOR * integrated.std())
+    if causal:
+        # Line the beats up with the zero-phase timeline (RR intervals are unaffected)
+        shift = int(round(CausalFilter(sos, sample_rate).delay))
+        peaks = np.clip(peaks - shift, 0, len(integrated) - 1)
+    peaks = peaks[good[peaks]]
+    stage('find_peaks')
 
     if PRODUCE_GRAPHS:
         plt.figure(figsize=(15, 5))
@@ -205,9 +317,11 @@ def process_ppg_file(filename: str):
 
     # --- Heart rate calculation ---
     if len(peaks) > 1:
-        rr_ms = np.diff(peaks) / SAMPLE_RATE * 1000
+        rr_ms = np.diff(peaks) / sample_rate * 1000
         median_rr = np.median(rr_ms)
         valid = (rr_ms > RR_LOWER_FACTOR * median_rr) & (rr_ms < RR_UPPER_FACTOR * median_rr)
+        bad_count = np.cumsum(~good)                          # No RR interval across a rejected window
+        valid &= bad_count[peaks[1:]] == bad_count[peaks[:-1]]
         rr_clean = rr_ms[valid]
 
         if len(rr_clean) > 0:
@@ -216,19 +330,21 @@ def process_ppg_file(filename: str):
             mean_hr = np.mean(hr_bpm)
             rmssd = np.sqrt(np.mean(np.diff(rr_clean)**2))
             sdnn = np.std(rr_clean)  # Additional HRV metric
-            perfusion_x10 = int((np.std(ir_bp) / np.mean(ir_trim)) * 1000)
+            perfusion_x10 = int((np.std(ir_bp[good]) / np.mean(ir_trim[good])) * 1000)
+            stage('hrv')
 
             # Respiration rate estimate (FFT on low-freq PPG)
-            fft = np.fft.rfft(ir_bp)
-            freq = np.fft.rfftfreq(len(ir_bp), 1/SAMPLE_RATE)
+            fft = np.fft.rfft(np.where(good, ir_bp, 0.0))
+            freq = np.fft.rfftfreq(len(ir_bp), 1/sample_rate)
             low_freq_mask = (freq > 0.1) & (freq < 0.5)
             resp_freq = freq[low_freq_mask][np.argmax(np.abs(fft[low_freq_mask]))]
             respiration = resp_freq * 60  # breaths/min
+            stage('respiration')
 
-            print(f"\n=== FINAL METRICS ===")
-            print(f"Mean HR: {mean_hr:.1f} bpm")
-            print(f"RMSSD: {rmssd:.1f} ms")
-            print(f"Detected peaks: {len(peaks)}")
+            log(f"\n=== FINAL METRICS ===")
+            log(f"Mean HR: {mean_hr:.1f} bpm")
+            log(f"RMSSD: {rmssd:.1f} ms")
+            log(f"Detected peaks: {len(peaks)}")
 
             if PRODUCE_GRAPHS:
                 plt.figure(figsize=(15, 5))
@@ -241,27 +357,30 @@ def process_ppg_file(filename: str):
                 plt.tight_layout()
                 plt.show()
         else:
-            print("No valid RR intervals after cleaning")
+            log("No valid RR intervals after cleaning")
     else:
-        print("No peaks detected")
+        log("No peaks detected")
 
     # --- SpO2 estimate ---
     red_bp = bandpass_filter(red_trim - np.mean(red_trim))
-    delay = int(SPO2_DELAY_SEC * SAMPLE_RATE)
+    delay = int(SPO2_DELAY_SEC * sample_rate)
     red_shifted = np.roll(red_bp, delay)
     red_shifted[:delay] = red_shifted[delay]
 
     def ac_dc(sig):
-        sos = butter(4, 0.5, 'low', fs=SAMPLE_RATE, output='sos')
-        low = sosfiltfilt(sos, sig)
+        if causal:
+            low = CausalFilter(lowpass_sos(sample_rate), sample_rate).process(sig)
+        else:
+            low = sosfiltfilt(lowpass_sos(sample_rate), sig)
         ac = sig - low
-        return np.std(ac), np.mean(low)
+        return np.std(ac[good]), np.mean(low[good])
 
     ac_ir, dc_ir = ac_dc(ir_bp)
     ac_red, dc_red = ac_dc(red_shifted)
     R = (ac_red / dc_red) / (ac_ir / dc_ir + 1e-8)
     spo2 = np.clip(110 - 25 * R, 85, 100)
-    print(f"Estimated SpO2: {spo2:.1f}%")
+    stage('spo2')
+    log(f"Estimated SpO2: {spo2:.1f}%")
 
     return {
         'mean_hr': mean_hr if 'mean_hr' in locals() else None,
@@ -270,7 +389,8 @@ def process_ppg_file(filename: str):
         'spo2': spo2,
         'perfusion_index_x10': perfusion_x10 if 'perfusion_x10' in locals() else None,
         'respiration_rate': respiration if 'respiration' in locals() else None,
-        'peaks': peaks.tolist() if 'peaks' in locals() else []
+        'peaks': peaks.tolist() if 'peaks' in locals() else [],
+        'quality': quality
     }
 
 # ================================================================
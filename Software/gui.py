@@ -1,25 +1,43 @@
 # gui.py
 # Fixed: Start button works reliably using st.form
 # No disappearing button, proper action on click
+# Live view: metrics, HR trend and pulse waveform update in place from the
+# control plane's pushed streams (no full-page rerun per tick)
 
 import streamlit as st
-import json
 import time
-import os
+from collections import deque
 import numpy as np
+import pandas as pd
 import matplotlib.pyplot as plt
 
+from control_plane import ControlClient
+
+TEST_SECONDS = 60
+LIVE_TICK_SEC = 0.2          # Waveform refresh period during a test
+WAVEFORM_POINTS = 500        # Live waveform span: 10 s of the engine's 50 envelope points/s
+
 st.set_page_config(layout="wide")
 st.title("BioWatch PPG Health Monitor")
 
+# One control connection per GUI process: start/stop go out, link state and
+# metrics are pushed in (no flag files, no polling of latest_metrics.json)
+@st.cache_resource
+def control_client():
+    return ControlClient()
+
+client = control_client()
+
 # Initialize session state
 if 'test_running' not in st.session_state:
     st.session_state.test_running = False
 if 'metrics_history' not in st.session_state:
     st.session_state.metrics_history = []
+    st.session_state.metrics_cursor = 0
+    st.session_state.waveform_cursor = 0
 
 # BLE connection status
-ble_connected = os.path.exists("ble_connected.txt")
+ble_connected = client.connected
 status_text = "Connected – Ready to Test" if ble_connected else "Waiting for Bluetooth connection..."
 status_color = "green" if ble_connected else "orange"
 st.markdown(f"**BLE Status:** <span style='color:{status_color}'>{status_text}</span>", unsafe_allow_html=True)
@@ -31,6 +49,14 @@ sex = st.sidebar.selectbox("Sex", ["Male", "Female"])
 weight_kg = st.sidebar.number_input("Weight (kg)", 40, 150, 70)
 height_cm = st.sidebar.number_input("Height (cm)", 140, 220, 170)
 
+# Metrics over the whole test, or over one of the engine's sliding windows
+metrics_window = st.sidebar.selectbox("Metrics window", ["Session", "10s", "30s", "5min"])
+
+def windowed(metrics):
+    """HR / HRV (and SpO2, perfusion, respiration) of the selected window, if the engine reports it."""
+    window = metrics.get('windows', {}).get(metrics_window) if metrics_window != "Session" else None
+    return {**metrics, **window} if window else metrics
+
 # === Start Button using st.form (this fixes the disappearing issue) ===
 if not st.session_state.test_running:
     with st.form("start_form"):
@@ -45,77 +71,119 @@ if not st.session_state.test_running:
             st.session_state.test_running = True
             st.session_state.start_time = time.time()
             st.session_state.metrics_history = []
-            open("start.txt", "w").close()
+            st.session_state.metrics_cursor = client.metrics_count     # Only this test's pushes
+            st.session_state.waveform_cursor = client.waveform_count
+            client.send('start')
             st.success("Test started – streaming from sensor")
             st.rerun()
 
 # === Real-Time Test Display + Manual Stop Button ===
-if st.session_state.test_running:
-    elapsed = time.time() - st.session_state.start_time
-
-    # Auto-stop at 60 seconds
-    if elapsed >= 60:
-        st.session_state.test_running = False
-        open("stop.txt", "w").close()
-        st.success("Test complete (auto-stop at 60s)")
-
-    placeholder = st.empty()
-    with placeholder.container():
-        col_time, col_stop = st.columns([3, 1])
-        col_time.header(f"Test Running – {elapsed:.1f}s / 60s")
-
-        # Manual Stop button
-        if col_stop.button("Stop Test", type="secondary", use_container_width=True):
-            open("stop.txt", "w").close()
-            st.session_state.test_running = False
-            st.success("Test stopped manually")
-
-        # Load metrics
-        try:
-            with open("latest_metrics.json", "r") as f:
-                metrics = json.load(f)
-            st.session_state.metrics_history.append(metrics)
-        except:
-            metrics = {}
+# Laid out once per run, then updated in place: metric slots are rewritten and
+# the charts only get the points pushed since the last tick (add_rows), so a
+# tick costs the same at the end of a long session as at its start
+def show_metrics(slots, metrics):
+    hr = metrics.get('mean_hr')
+    slots[0].metric("Heart Rate", f"{hr:.1f} bpm" if isinstance(hr, (int, float)) and hr is not None else "— bpm")
+
+    spo2 = metrics.get('spo2')
+    slots[1].metric("SpO₂", f"{spo2:.1f}%" if isinstance(spo2, (int, float)) and spo2 is not None else "—%")
+
+    rmssd = metrics.get('rmssd')
+    slots[2].metric("RMSSD (HRV)", f"{rmssd:.1f} ms" if isinstance(rmssd, (int, float)) and rmssd is not None else "— ms")
+
+    sdnn = metrics.get('sdnn')
+    slots[3].metric("SDNN (HRV)", f"{sdnn:.1f} ms" if isinstance(sdnn, (int, float)) and sdnn is not None else "— ms")
+
+    # Stress Level
+    if isinstance(rmssd, (int, float)) and rmssd is not None:
+        if rmssd > 50:
+            stress_level = "Low"
+        elif rmssd > 30:
+            stress_level = "Medium"
+        else:
+            stress_level = "High"
+    else:
+        stress_level = "—"
+    slots[4].metric("Stress Level", stress_level)
 
-        # Display all metrics (same as your full version)
-        col1, col2, col3, col4 = st.columns(4)
+    # Perfusion Index
+    perfusion_raw = metrics.get('perfusion_index_x10')
+    perfusion = perfusion_raw / 10 if isinstance(perfusion_raw, (int, float)) else None
+    slots[5].metric("Perfusion Index", f"{perfusion:.2f}" if perfusion is not None else "—")
 
-        hr = metrics.get('mean_hr')
-        col1.metric("Heart Rate", f"{hr:.1f} bpm" if isinstance(hr, (int, float)) and hr is not None else "— bpm")
+    # Respiration Rate
+    resp = metrics.get('respiration_rate')
+    slots[6].metric("Respiration Rate", f"{resp:.1f} br/min" if isinstance(resp, (int, float)) and resp is not None else "—")
 
-        spo2 = metrics.get('spo2')
-        col2.metric("SpO₂", f"{spo2:.1f}%" if isinstance(spo2, (int, float)) and spo2 is not None else "—%")
+def hr_rows(history, first):
+    return pd.DataFrame({'HR (bpm)': [windowed(m).get('mean_hr') for m in history[first:]]},
+                        index=range(first, len(history)), dtype=float)
 
-        rmssd = metrics.get('rmssd')
-        col3.metric("RMSSD (HRV)", f"{rmssd:.1f} ms" if isinstance(rmssd, (int, float)) and rmssd is not None else "— ms")
+def waveform_rows(points):
+    t, lo, hi = zip(*points) if points else ((), (), ())
+    return pd.DataFrame({'min': lo, 'max': hi}, index=pd.Index(t, name='s'), dtype=float)
 
-        sdnn = metrics.get('sdnn')
-        col4.metric("SDNN (HRV)", f"{sdnn:.1f} ms" if isinstance(sdnn, (int, float)) and sdnn is not None else "— ms")
+if st.session_state.test_running:
+    col_time, col_stop = st.columns([3, 1])
 
-        # Stress Level
-        if isinstance(rmssd, (int, float)) and rmssd is not None:
-            if rmssd > 50:
-                stress_level = "Low"
-            elif rmssd > 30:
-                stress_level = "Medium"
+    # Manual Stop button
+    if col_stop.button("Stop Test", type="secondary", use_container_width=True):
+        client.send('stop')
+        st.session_state.test_running = False
+        st.rerun()
+
+    timer = col_time.empty()
+    warning = st.empty()
+    slots = [col.empty() for col in st.columns(4)] + [st.empty() for _ in range(3)]
+
+    history = st.session_state.metrics_history
+    show_metrics(slots, windowed(history[-1]) if history else {})
+    st.subheader("Heart Rate Trend")
+    hr_chart = st.line_chart(hr_rows(history, 0))
+    st.subheader("Pulse Waveform (bandpassed IR, min/max envelope)")
+    wave_slot = st.empty()
+    points, wave_cursor = client.read_waveform(st.session_state.waveform_cursor)
+    wave_tail = deque(points, maxlen=WAVEFORM_POINTS)
+    wave_chart = wave_slot.line_chart(waveform_rows(wave_tail))
+    wave_rows = len(wave_tail)
+
+    while True:
+        elapsed = time.time() - st.session_state.start_time
+
+        # Auto-stop at 60 seconds
+        if elapsed >= TEST_SECONDS:
+            st.session_state.test_running = False
+            client.send('stop')
+            st.rerun()
+        timer.header(f"Test Running – {elapsed:.1f}s / {TEST_SECONDS}s")
+
+        new_metrics, st.session_state.metrics_cursor = client.read_metrics(st.session_state.metrics_cursor)
+        if new_metrics:
+            first = len(history)
+            history.extend(new_metrics)
+            hr_chart.add_rows(hr_rows(history, first))
+            metrics = windowed(history[-1])
+            show_metrics(slots, metrics)
+            quality = metrics.get('quality') or {}
+            if quality.get('ok') is False:
+                warning.warning(f"Poor signal ({(quality.get('reason') or 'unknown').replace('_', ' ')}) – "
+                                "check sensor placement; processing is paused")
             else:
-                stress_level = "High"
-        else:
-            stress_level = "—"
-        st.metric("Stress Level", stress_level)
-
-        # Perfusion Index
-        perfusion_raw = metrics.get('perfusion_index_x10')
-        perfusion = perfusion_raw / 10 if isinstance(perfusion_raw, (int, float)) else None
-        st.metric("Perfusion Index", f"{perfusion:.2f}" if perfusion is not None else "—")
-
-        # Respiration Rate
-        resp = metrics.get('respiration_rate')
-        st.metric("Respiration Rate", f"{resp:.1f} br/min" if isinstance(resp, (int, float)) and resp is not None else "—")
+                warning.empty()
+
+        points, wave_cursor = client.read_waveform(wave_cursor)
+        if points:
+            wave_tail.extend(points)
+            if wave_rows + len(points) > 2 * wave_tail.maxlen:
+                # Redraw from the tail now and then, so the browser's chart stays bounded too
+                wave_chart = wave_slot.line_chart(waveform_rows(wave_tail))
+                wave_rows = len(wave_tail)
+            else:
+                wave_chart.add_rows(waveform_rows(points))
+                wave_rows += len(points)
 
-    time.sleep(1)
-    st.rerun()
+        # Next tick as soon as metrics arrive, else at the waveform rate
+        client.wait_update(timeout=LIVE_TICK_SEC)
 
 # === Final Results ===
 if not st.session_state.test_running and st.session_state.metrics_history:
@@ -149,7 +217,12 @@ if not st.session_state.test_running and st.session_state.metrics_history:
         fig, ax = plt.subplots(figsize=(12, 5))
         ax.plot(hr_list, color='green', linewidth=2.5, marker='o')
         ax.set_title("Heart Rate Trend During Test")
-        ax.set_xlabel("Update (~every 5s)")
+        ax.set_xlabel("Update (~every second)")
         ax.set_ylabel("BPM")
         ax.grid(alpha=0.3)
-        st.pyplot(fig)
\ No newline at end of file
+        st.pyplot(fig)
+
+# Waiting for the sensor: redraw when the link state changes
+if not st.session_state.test_running and not ble_connected:
+    client.wait_update(timeout=5.0)
+    st.rerun()
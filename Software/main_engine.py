@@ -6,32 +6,56 @@ import threading
 import subprocess
 import time
 import os
-import pandas as pd
+import json
 
-from ble_connection import start_ble_listener_thread
-from filtering import process_ppg_file
+from ble_connection import start_ble_listener_thread, current_output_rate, sample_ring
+from sample_ring import RingReader
+from control_plane import plane
+from stream_engine import IncrementalEngine, WaveformEnvelope
 
-CSV_FILE = "latest_ppg_data.csv"
 METRICS_FILE = "latest_metrics.json"
 MIN_SAMPLES_FOR_PROCESS = 1000  # ~5s at 200 Hz
+UPDATE_PERIOD_SEC = 1.0         # Metrics publish period
+POLL_PERIOD_SEC = 0.1           # Ring poll period: bounds how late a 'beat' event is
 
 def processing_thread():
+    reader = RingReader(sample_ring, "processor")
+    engine = envelope = None
+    last_update = 0.0
+
+    def on_beat(index, rr_ms):
+        lag_ms = (engine.next_idx - 1 - index) / engine.fs * 1000
+        plane.publish('beat', {'index': int(index - engine.origin), 'rr_ms': rr_ms, 'lag_ms': lag_ms})
+
+    def on_filtered(start, ir_bp):
+        points = envelope.push(start - engine.origin, ir_bp)
+        if points is not None:
+            plane.publish('waveform', points)
+
     while True:
         try:
-            if os.path.exists(CSV_FILE):
-                df = pd.read_csv(CSV_FILE)
-                if len(df) >= MIN_SAMPLES_FOR_PROCESS:
-                    metrics = process_ppg_file(CSV_FILE)
-                    with open(METRICS_FILE, "w") as f:
-                        import json
-                        json.dump(metrics or {}, f)
+            records, restarted = reader.read_new()
+            rate = current_output_rate()
+            if restarted or engine is None or engine.fs != rate:
+                engine = IncrementalEngine(sample_rate=rate, on_beat=on_beat, on_filtered=on_filtered)
+                envelope = WaveformEnvelope(rate)
+            if records is not None:
+                engine.feed(records['idx'], records['ir'], records['red'])
+            now = time.monotonic()
+            if engine.samples >= MIN_SAMPLES_FOR_PROCESS and now - last_update >= UPDATE_PERIOD_SEC:
+                last_update = now
+                metrics = engine.metrics()
+                plane.publish('metrics', metrics)
+                with open(METRICS_FILE, "w") as f:
+                    json.dump(metrics, f)
         except Exception as e:
             print(f"Processing error: {e}")
-        time.sleep(5)
+        time.sleep(POLL_PERIOD_SEC)
 
 if __name__ == "__main__":
-    # Force correct working directory so all files (CSV, flags) are in the same folder
+    # Force correct working directory so all files (CSV, metrics) are in the same folder
     os.chdir(os.path.dirname(os.path.abspath(__file__)))
+    plane.serve()     # GUI connects here for start/stop and pushed metrics
 
     threading.Thread(target=start_ble_listener_thread, daemon=True).start()
     threading.Thread(target=processing_thread, daemon=True).start()
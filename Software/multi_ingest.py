@@ -0,0 +1,212 @@
+# multi_ingest.py
+# Multi-subject host: one asyncio task per wearable on the BLE side, one worker
+# process per subject for the processing, and a per-device metrics channel
+# instead of the shared flag files / latest_metrics.json
+#
+# Usage: python multi_ingest.py [seconds]   (runs until Ctrl-C without a duration)
+
+import asyncio
+import json
+import multiprocessing as mp
+import os
+import queue
+import sys
+
+from bleak import BleakScanner, BleakClient
+
+import ble_connection as ble
+from ble_connection import SensorSession, COMMAND_UUID
+from sample_ring import RingReader
+from stream_engine import IncrementalEngine
+
+# ================================================================
+# TUNABLE CONSTANTS
+# ================================================================
+DEVICE_NAME_PREFIX = "PPG_Sensor"    # Every advertiser whose name starts with this is a subject
+SCAN_SECONDS = 15.0
+MAX_SUBJECTS = 8
+DISPATCH_PERIOD_SEC = 1.0            # Ring -> worker hand-off and metrics collection
+MIN_SAMPLES_FOR_METRICS = 1000       # ~5s at 200 Hz
+OUTPUT_DIR = "subjects"              # <device_id>_session_<start>.ppgs / _metrics.json / _stats.json
+
+# ================================================================
+# PROCESSING WORKER (one process per subject)
+# ================================================================
+def engine_worker(device_id, inbox, outbox):
+    """
+    Owns one subject's IncrementalEngine. inbox carries ('reset', sample_rate),
+    ('samples', (idx, ir, red)) or None (exit); metrics go to the shared outbox.
+    """
+    engine = None
+    while True:
+        msg = inbox.get()
+        if msg is None:
+            return
+        kind, payload = msg
+        if kind == 'reset':
+            engine = IncrementalEngine(sample_rate=payload)
+        elif kind == 'samples' and engine is not None:
+            engine.feed(*payload)
+            if engine.samples >= MIN_SAMPLES_FOR_METRICS:
+                outbox.put((device_id, engine.metrics()))
+
+# ================================================================
+# PER-DEVICE CHANNEL
+# ================================================================
+class DeviceChannel:
+    """
+    Latest link state and metrics of one subject. Subscribers are called as
+    callback(device_id, event, value) with event 'connected' or 'metrics'; the
+    metrics are also written to the subject's own JSON file.
+    """
+
+    def __init__(self, device_id, metrics_file):
+        self.device_id = device_id
+        self.metrics_file = metrics_file
+        self.connected = False
+        self.metrics = None
+        self.subscribers = []
+
+    def subscribe(self, callback):
+        self.subscribers.append(callback)
+
+    def set_connected(self, connected):
+        if connected != self.connected:
+            self.connected = connected
+            self._notify('connected', connected)
+
+    def publish_metrics(self, metrics):
+        self.metrics = metrics
+        with open(self.metrics_file, "w") as f:
+            json.dump(metrics, f)
+        self._notify('metrics', metrics)
+
+    def _notify(self, event, value):
+        for callback in self.subscribers:
+            callback(self.device_id, event, value)
+
+class Subject:
+    """One wearable: BLE session + ring, processing worker, output channel."""
+
+    def __init__(self, device, ctx, outbox):
+        self.device = device
+        self.device_id = f"{device.name}_{device.address.replace(':', '')[-4:]}"
+        base = os.path.join(OUTPUT_DIR, self.device_id)
+        self.session = SensorSession(self.device_id, csv_file=base + "_ppg.csv",
+                                     metrics_file=base + "_metrics.json", stats_file=base + "_stats.json",
+                                     session_dir=OUTPUT_DIR)
+        self.channel = DeviceChannel(self.device_id, self.session.metrics_file)
+        self.session.on_metrics = self.channel.publish_metrics      # Metrics-only firmware
+        self.reader = RingReader(self.session.ring, self.device_id)
+        self.inbox = ctx.Queue()
+        self.worker = ctx.Process(target=engine_worker, args=(self.device_id, self.inbox, outbox), daemon=True)
+        self.rate = None                                            # Rate the worker's engine runs at
+
+# ================================================================
+# BLE SIDE (one task per subject) AND DISPATCH
+# ================================================================
+async def run_subject(subject, stop):
+    s = subject.session
+    s.reset()
+    s.start_archives()
+    client = BleakClient(subject.device.address)
+    archiver = None
+    try:
+        await client.connect(timeout=20.0)
+        subject.channel.set_connected(True)
+        await s.subscribe(client)
+        await s.configure_stream(client)
+        fmt = await s.negotiate_and_start(client)
+        print(f"[SUCCESS] {s.label}Streaming started (wire format {fmt})")
+        if ble.ARCHIVE_SESSION or ble.ARCHIVE_CSV:
+            archiver = asyncio.create_task(s.archive_task())
+
+        while not stop.is_set():
+            if not client.is_connected:
+                subject.channel.set_connected(False)
+                print(f"[ERROR] {s.label}BLE link lost – reconnecting")
+                client = await s.reconnect(subject.device.address)
+                if client is None:
+                    break
+                subject.channel.set_connected(True)
+            try:
+                await asyncio.wait_for(stop.wait(), 0.5)
+            except asyncio.TimeoutError:
+                pass
+
+        if client is not None and client.is_connected:
+            await client.write_gatt_char(COMMAND_UUID, b'P')
+            print(f"[SUCCESS] {s.label}Sent 'P' – streaming stopped")
+        if archiver is not None:
+            archiver.cancel()
+            saved = await asyncio.to_thread(s.flush_archives)
+            print(f"[ARCHIVE] {s.label}Final save: {saved} samples")
+    except Exception as e:
+        print(f"[ERROR] {s.label}BLE error: {e}")
+    finally:
+        if client is not None:
+            await client.disconnect()
+        subject.channel.set_connected(False)
+
+async def dispatch(subjects, outbox):
+    """Moves each subject's new samples to its worker and publishes returned metrics."""
+    by_id = {s.device_id: s for s in subjects}
+    while True:
+        for s in subjects:
+            records, restarted = s.reader.read_new()
+            if restarted or s.rate != s.session.output_rate:
+                s.rate = s.session.output_rate
+                s.inbox.put(('reset', s.rate))
+            if records is not None:
+                s.inbox.put(('samples', (records['idx'].copy(), records['ir'].copy(), records['red'].copy())))
+        while True:
+            try:
+                device_id, metrics = outbox.get_nowait()
+            except queue.Empty:
+                break
+            by_id[device_id].channel.publish_metrics(metrics)
+        await asyncio.sleep(DISPATCH_PERIOD_SEC)
+
+def print_event(device_id, event, value):
+    if event == 'connected':
+        print(f"[DEBUG] {device_id}: {'connected' if value else 'disconnected'}")
+    elif value.get('mean_hr') is not None:
+        print(f"[METRICS] {device_id}: HR {value['mean_hr']:.1f} bpm, SpO2 {value['spo2']}")
+
+async def ingest(duration=None):
+    os.makedirs(OUTPUT_DIR, exist_ok=True)
+    print(f"Scanning for {DEVICE_NAME_PREFIX}* ...")
+    devices = await BleakScanner.discover(timeout=SCAN_SECONDS)
+    found = [d for d in devices if d.name and d.name.startswith(DEVICE_NAME_PREFIX)][:MAX_SUBJECTS]
+    if not found:
+        print("[ERROR] No sensors found!")
+        return
+    print(f"[SUCCESS] Found {len(found)} sensor(s)")
+
+    # spawn: workers must not inherit the event loop / Bleak threads
+    ctx = mp.get_context('spawn')
+    outbox = ctx.Queue()
+    subjects = [Subject(d, ctx, outbox) for d in found]
+    for s in subjects:
+        s.channel.subscribe(print_event)
+        s.worker.start()
+
+    stop = asyncio.Event()
+    tasks = [asyncio.create_task(run_subject(s, stop)) for s in subjects]
+    dispatcher = asyncio.create_task(dispatch(subjects, outbox))
+    try:
+        if duration is not None:
+            await asyncio.sleep(duration)
+        else:
+            await asyncio.gather(*tasks)
+    finally:
+        stop.set()
+        await asyncio.gather(*tasks, return_exceptions=True)
+        dispatcher.cancel()
+        for s in subjects:
+            s.inbox.put(None)
+            s.worker.join(timeout=5)
+
+if __name__ == "__main__":
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+    asyncio.run(ingest(float(sys.argv[1]) if len(sys.argv) > 1 else None))
@@ -0,0 +1,143 @@
+# sample_ring.py
+# In-process hand-off between the BLE receiver and the processor: a preallocated
+# NumPy ring with a write cursor, so samples never go through a text file on
+# the way to the metrics (the CSV is only an optional archive)
+
+import os
+import threading
+
+import numpy as np
+
+# ================================================================
+# TUNABLE CONSTANTS
+# ================================================================
+SAMPLE_RING_SIZE = 1 << 15           # Samples kept (power of two, ~80 s at 400 Hz)
+
+SAMPLE_DTYPE = np.dtype([('seq', 'u1'), ('idx', 'i8'), ('ir', 'u4'), ('red', 'u4')])
+CSV_HEADER = "seq,IR,Red,idx"
+
+# ================================================================
+# RING
+# ================================================================
+class SampleRing:
+    """
+    Single writer (the asyncio BLE thread), any number of readers with their own
+    cursor. written counts samples since the session started; the writer fills
+    the slots first and publishes the new count afterwards, so a reader never
+    sees a half-written block. A reader more than SAMPLE_RING_SIZE behind loses
+    the oldest samples (reported by read()).
+    """
+
+    def __init__(self, size=SAMPLE_RING_SIZE):
+        assert size & (size - 1) == 0, "ring size must be a power of two"
+        self.size = size
+        self.mask = size - 1
+        self.data = np.zeros(size, dtype=SAMPLE_DTYPE)
+        self.written = 0
+        self.session = 0
+
+    def reset(self):
+        """Starts a new session; readers see restarted=True on their next read."""
+        self.written = 0                    # Before the session bump: readers wait, never re-read
+        self.session += 1
+
+    def write(self, seq, first_index, ir, red):
+        n = len(ir)
+        if n == 0:
+            return
+        if n > self.size:
+            raise ValueError("block larger than the ring")
+        start = self.written & self.mask
+        first = min(n, self.size - start)
+        for lo, hi, dst in ((0, first, start), (first, n, 0)):
+            if hi > lo:
+                block = self.data[dst:dst + hi - lo]
+                block['seq'] = seq
+                block['idx'] = np.arange(first_index + lo, first_index + hi)
+                block['ir'] = ir[lo:hi]
+                block['red'] = red[lo:hi]
+        self.written += n                   # Publish only once the slots are filled
+
+    def read(self, cursor, limit=None):
+        """
+        Returns (records, new_cursor, lost) for the samples after cursor. records
+        is a view into the ring when the span does not wrap, else a copy; a view
+        stays valid until the writer laps it, so consume it before the next read.
+        """
+        end = self.written
+        lost = 0
+        if end < cursor:                    # Session reset in progress, see reset()
+            return self.data[0:0], cursor, 0
+        if end - cursor > self.size:
+            lost = end - self.size - cursor
+            cursor = end - self.size
+        if limit is not None:
+            end = min(end, cursor + limit)
+        lo, hi = cursor & self.mask, end & self.mask
+        if end == cursor:
+            records = self.data[0:0]
+        elif lo < hi:
+            records = self.data[lo:hi]
+        else:
+            records = np.concatenate((self.data[lo:], self.data[:hi]))
+        return records, end, lost
+
+class RingReader:
+    """
+    Cursor over a SampleRing. read_new() returns the records written since the
+    last call (None if there are none) and whether the ring was restarted since
+    (new recording). A reader more than a ring behind skips the overwritten
+    samples and logs how many it lost.
+    """
+
+    def __init__(self, ring, name="reader"):
+        self.ring = ring
+        self.name = name
+        self.cursor = 0
+        self.session = ring.session
+
+    def read_new(self):
+        restarted = self.session != self.ring.session
+        if restarted:
+            self.session = self.ring.session
+            self.cursor = 0
+        records, self.cursor, lost = self.ring.read(self.cursor)
+        if lost:
+            print(f"[RING] {self.name} fell behind – {lost} samples overwritten")
+        return (records if len(records) else None), restarted
+
+# ================================================================
+# CSV ARCHIVE SINK (optional, off the receive path)
+# ================================================================
+class CsvArchive:
+    """
+    Appends everything written to the ring to a CSV file in the same column
+    layout as before (seq, IR, Red, idx), from its own reader cursor. flush() only
+    formats and writes text, so run it in a worker thread (asyncio.to_thread).
+    """
+
+    def __init__(self, ring, filename):
+        self.reader = RingReader(ring, "CSV archive")
+        self.filename = filename
+        self.lock = threading.Lock()
+        self.saved = 0
+
+    def start(self):
+        """New session: truncates the archive."""
+        with self.lock:
+            if os.path.exists(self.filename):
+                os.remove(self.filename)
+            self.reader = RingReader(self.reader.ring, self.reader.name)
+            self.saved = 0
+
+    def flush(self):
+        with self.lock:
+            records, _ = self.reader.read_new()
+            if records is None:
+                return 0
+            new_file = not os.path.exists(self.filename)
+            with open(self.filename, 'a') as f:
+                np.savetxt(f, np.column_stack((records['seq'], records['ir'], records['red'], records['idx'])),
+                           fmt='%d', delimiter=',', header=CSV_HEADER if new_file else '', comments='')
+            self.saved += len(records)
+            return len(records)
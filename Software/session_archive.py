@@ -0,0 +1,268 @@
+# session_archive.py
+# Append-only binary session archive (.ppgs): a fixed header with sample rate,
+# firmware config and start time, then chunks of little-endian IR/Red arrays.
+# Every chunk covers consecutive sample indices, so the chunk table doubles as
+# the gap/loss index. Readers memory-map the file: no parsing, and a slice of a
+# multi-hour session touches only the chunks it overlaps.
+#
+# Layout (little-endian):
+#   header (HEADER_BYTES): magic "PPGSESS1", version u16, header_bytes u16,
+#                          start_time f8 (unix s), sample_rate u32, wire_format u8,
+#                          reserved u8, config_len u16, config JSON, zero padding
+#   chunk:                 magic "CHNK", count u32, first_index i8,
+#                          IR u32 x count, Red u32 x count
+#
+# Usage: python session_archive.py latest_ppg_data.csv [more.csv ...] [--rate 200]
+
+import argparse
+import json
+import os
+import struct
+import threading
+import time
+
+import numpy as np
+import pandas as pd
+
+from sample_ring import RingReader
+
+# ================================================================
+# FORMAT
+# ================================================================
+SESSION_SUFFIX = ".ppgs"
+SESSION_MAGIC = b"PPGSESS1"
+SESSION_VERSION = 1
+HEADER_BYTES = 512
+HEADER = struct.Struct('<8sHHdIBBH')
+CHUNK_MAGIC = b"CHNK"
+CHUNK = struct.Struct('<4sIq')
+SAMPLES_PER_SEQ = 32                 # v1 firmware chunk at the default config: samples per seq (the one definition)
+
+def encode_header(sample_rate, config=None, wire_format=0, start_time=None):
+    blob = json.dumps(config or {}, separators=(',', ':')).encode()
+    if HEADER.size + len(blob) > HEADER_BYTES:
+        raise ValueError("session config does not fit the header")
+    start_time = time.time() if start_time is None else start_time
+    head = HEADER.pack(SESSION_MAGIC, SESSION_VERSION, HEADER_BYTES, start_time,
+                       int(sample_rate), int(wire_format), 0, len(blob))
+    return (head + blob).ljust(HEADER_BYTES, b'\0')
+
+def encode_chunks(idx, ir, red):
+    """One chunk per run of consecutive indices."""
+    breaks = np.flatnonzero(np.diff(idx) != 1) + 1
+    out = []
+    for lo, hi in zip(np.concatenate(([0], breaks)), np.concatenate((breaks, [len(idx)]))):
+        out.append(CHUNK.pack(CHUNK_MAGIC, int(hi - lo), int(idx[lo])))
+        out.append(np.ascontiguousarray(ir[lo:hi], dtype='<u4').tobytes())
+        out.append(np.ascontiguousarray(red[lo:hi], dtype='<u4').tobytes())
+    return b"".join(out)
+
+def is_session_archive(path):
+    try:
+        with open(path, 'rb') as f:
+            return f.read(len(SESSION_MAGIC)) == SESSION_MAGIC
+    except OSError:
+        return False
+
+def legacy_sample_index(seq, samples_per_seq=SAMPLES_PER_SEQ):
+    """Legacy files only have the u8 chunk seq: unwrap it and count within each chunk."""
+    seq = np.asarray(seq, dtype=np.int64)
+    wraps = np.concatenate(([0], np.cumsum(np.diff(seq) < 0)))
+    seq_unwrapped = seq + 256 * wraps
+    rows = np.arange(len(seq))
+    run_start = np.concatenate(([True], np.diff(seq_unwrapped) != 0))
+    pos = rows - np.maximum.accumulate(np.where(run_start, rows, 0))
+    return seq_unwrapped * samples_per_seq + pos
+
+# ================================================================
+# READER
+# ================================================================
+class SessionFile:
+    """
+    Memory-mapped view of a session archive. ir/red/idx are the whole session
+    (concatenated once from the chunk views); read(lo, hi) and chunk() only map
+    what they need. A chunk cut short by a crash mid-write is ignored.
+    """
+
+    def __init__(self, path):
+        self.path = path
+        self.mm = np.memmap(path, dtype=np.uint8, mode='r')
+        magic, version, header_bytes, self.start_time, self.sample_rate, self.wire_format, _, config_len = \
+            HEADER.unpack_from(self.mm, 0)
+        if magic != SESSION_MAGIC or version != SESSION_VERSION:
+            raise ValueError(f"{path}: not a version {SESSION_VERSION} session archive")
+        self.config = json.loads(bytes(self.mm[HEADER.size:HEADER.size + config_len]) or b"{}")
+
+        firsts, counts, offsets = [], [], []
+        pos, size = header_bytes, len(self.mm)
+        while pos + CHUNK.size <= size:
+            magic, count, first = CHUNK.unpack_from(self.mm, pos)
+            end = pos + CHUNK.size + 8 * count
+            if magic != CHUNK_MAGIC or end > size:
+                break
+            firsts.append(first)
+            counts.append(count)
+            offsets.append(pos + CHUNK.size)
+            pos = end
+        self.chunk_first = np.array(firsts, dtype=np.int64)
+        self.chunk_count = np.array(counts, dtype=np.int64)
+        self.chunk_offset = np.array(offsets, dtype=np.int64)
+        self.samples = int(self.chunk_count.sum())
+        self._full = None
+
+    def __len__(self):
+        return self.samples
+
+    def chunk(self, c):
+        """(first_index, ir_view, red_view) of chunk c, straight from the map."""
+        count, off = int(self.chunk_count[c]), int(self.chunk_offset[c])
+        ir = np.ndarray(count, dtype='<u4', buffer=self.mm, offset=off)
+        red = np.ndarray(count, dtype='<u4', buffer=self.mm, offset=off + 4 * count)
+        return int(self.chunk_first[c]), ir, red
+
+    def gaps(self):
+        """(start_index, length) of every hole between chunks."""
+        ends = self.chunk_first + self.chunk_count
+        holes = self.chunk_first[1:] - ends[:-1]
+        lost = np.flatnonzero(holes > 0)
+        return ends[lost], holes[lost]
+
+    def read(self, lo, hi):
+        """(idx, ir, red) of the received samples with lo <= index < hi."""
+        first = int(np.searchsorted(self.chunk_first + self.chunk_count, lo, side='right'))
+        last = int(np.searchsorted(self.chunk_first, hi, side='left'))
+        parts = []
+        for c in range(first, last):
+            start, ir, red = self.chunk(c)
+            a, b = max(lo - start, 0), min(hi - start, len(ir))
+            if b > a:
+                parts.append((np.arange(start + a, start + b), ir[a:b], red[a:b]))
+        if not parts:
+            return np.zeros(0, np.int64), np.zeros(0, np.uint32), np.zeros(0, np.uint32)
+        return tuple(np.concatenate(p) for p in zip(*parts))
+
+    def _load(self):
+        if self._full is None:
+            ir = np.empty(self.samples, dtype=np.uint32)
+            red = np.empty(self.samples, dtype=np.uint32)
+            pos = 0
+            for c in range(len(self.chunk_first)):
+                _, cir, cred = self.chunk(c)
+                ir[pos:pos + len(cir)] = cir
+                red[pos:pos + len(cir)] = cred
+                pos += len(cir)
+            row_start = np.cumsum(self.chunk_count) - self.chunk_count
+            idx = np.arange(self.samples, dtype=np.int64) + np.repeat(self.chunk_first - row_start, self.chunk_count)
+            self._full = (idx, ir, red)
+        return self._full
+
+    @property
+    def idx(self):
+        return self._load()[0]
+
+    @property
+    def ir(self):
+        return self._load()[1]
+
+    @property
+    def red(self):
+        return self._load()[2]
+
+    def frame(self):
+        """The session in the CSV column layout (seq, IR, Red, idx)."""
+        idx, ir, red = self._load()
+        return pd.DataFrame({'seq': (idx // SAMPLES_PER_SEQ) & 0xFF, 'IR': ir, 'Red': red, 'idx': idx})
+
+# ================================================================
+# WRITERS
+# ================================================================
+def write_session(path, idx, ir, red, sample_rate, config=None, wire_format=0, start_time=None):
+    with open(path, 'wb') as f:
+        f.write(encode_header(sample_rate, config, wire_format, start_time))
+        if len(idx):
+            f.write(encode_chunks(np.asarray(idx, dtype=np.int64), ir, red))
+    return path
+
+class SessionArchive:
+    """
+    Ring sink like sample_ring.CsvArchive, but binary and one file per session:
+    begin() creates <directory>/<prefix>session_<start time>.ppgs once the stream
+    parameters are known, flush() appends what arrived since (run it in a worker
+    thread). Earlier sessions are kept.
+    """
+
+    def __init__(self, ring, directory=".", prefix=""):
+        self.reader = RingReader(ring, "session archive")
+        self.directory = directory
+        self.prefix = prefix
+        self.lock = threading.Lock()
+        self.path = None
+        self.saved = 0
+
+    def start(self):
+        """New session: nothing is written until begin()."""
+        with self.lock:
+            self.reader = RingReader(self.reader.ring, self.reader.name)
+            self.path = None
+            self.saved = 0
+
+    def begin(self, sample_rate, config=None, wire_format=0):
+        with self.lock:
+            start_time = time.time()
+            os.makedirs(self.directory, exist_ok=True)
+            stamp = time.strftime("%Y%m%d_%H%M%S", time.localtime(start_time))
+            base = os.path.join(self.directory, f"{self.prefix}session_{stamp}")
+            self.path, n = base + SESSION_SUFFIX, 1
+            while os.path.exists(self.path):              # A restarted segment within the same second
+                n += 1
+                self.path = f"{base}_{n}{SESSION_SUFFIX}"
+            with open(self.path, 'wb') as f:
+                f.write(encode_header(sample_rate, config, wire_format, start_time))
+            return self.path
+
+    def flush(self):
+        with self.lock:
+            if self.path is None:
+                return 0
+            records, _ = self.reader.read_new()
+            if records is None:
+                return 0
+            with open(self.path, 'ab') as f:
+                f.write(encode_chunks(records['idx'], records['ir'], records['red']))
+            self.saved += len(records)
+            return len(records)
+
+# ================================================================
+# CSV CONVERTER
+# ================================================================
+def convert_csv(csv_path, out_path=None, sample_rate=200, samples_per_seq=SAMPLES_PER_SEQ):
+    """Writes csv_path (seq, IR, Red[, idx]) as a session archive; returns the new path."""
+    df = pd.read_csv(csv_path)
+    if 'idx' in df.columns:
+        idx = df['idx'].values.astype(np.int64)
+    else:
+        idx = legacy_sample_index(df['seq'].values, samples_per_seq)
+    order = np.argsort(idx, kind='stable')
+    idx = idx[order]
+    keep = np.concatenate(([True], np.diff(idx) != 0))           # Drop duplicate indices
+    out_path = out_path or os.path.splitext(csv_path)[0] + SESSION_SUFFIX
+    return write_session(out_path, idx[keep], df['IR'].values[order][keep], df['Red'].values[order][keep],
+                         sample_rate, {'source': os.path.basename(csv_path)},
+                         start_time=os.path.getmtime(csv_path))
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert PPG CSV recordings to session archives")
+    parser.add_argument('csv', nargs='+')
+    parser.add_argument('--rate', type=int, default=200, help="output rate of the recording")
+    parser.add_argument('--samples-per-seq', type=int, default=SAMPLES_PER_SEQ, help="legacy files without idx")
+    args = parser.parse_args()
+    for csv_path in args.csv:
+        out = convert_csv(csv_path, sample_rate=args.rate, samples_per_seq=args.samples_per_seq)
+        archive = SessionFile(out)
+        holes, lengths = archive.gaps()
+        print(f"[SUCCESS] {csv_path} -> {out}: {len(archive)} samples in {len(archive.chunk_first)} chunks, "
+              f"{lengths.sum()} lost in {len(holes)} gaps, "
+              f"{os.path.getsize(csv_path) / 1e6:.2f} MB -> {os.path.getsize(out) / 1e6:.2f} MB")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,100 @@
+# signal_quality.py
+# Per-window signal-quality index (SQI), run before the Pan-Tompkins chain so
+# off-finger, saturated or motion-corrupted stretches are skipped and flagged
+# instead of being filtered and peak-searched for nothing. The raw-signal checks
+# (DC level, clipping) cost one pass over the window; only windows that pass
+# them are bandpassed (on their own) for perfusion, skewness and periodicity.
+
+import numpy as np
+from scipy.signal import sosfiltfilt
+
+# ================================================================
+# TUNABLE CONSTANTS
+# ================================================================
+SQI_WINDOW_SEC = 5.0                 # Quality is judged per window of this length
+ADC_FULL_SCALE = (1 << 18) - 1       # MAX30102 FIFO values are 18-bit, left-justified at any pulse width
+MIN_DC = 10000                       # IR below this: no finger (ambient / LED crosstalk only)
+CLIP_MARGIN = 256                    # Within this of 0 or full scale counts as clipped
+MAX_CLIPPED_FRACTION = 0.01
+MIN_PERFUSION = 0.0005               # AC/DC of the bandpassed IR: below this, no pulsatile signal
+MAX_PERFUSION = 0.10                 # Above this, motion rather than pulse
+MIN_ABS_SKEWNESS = 0.1               # A pulse wave is asymmetric; noise is not (sign depends on optics)
+MIN_PERIODICITY = 0.3                # Autocorrelation peak at a heart-rate lag
+HR_LAG_BPM = (40, 180)               # Lags searched for that peak
+
+# ================================================================
+# WINDOW QUALITY
+# ================================================================
+def window_quality(ir, red, sample_rate, sos):
+    """
+    SQI of one window of raw IR / Red; sos is the bandpass (filtering.bandpass_sos()).
+    Returns a dict: ok, reason (None or the first failed check) and the values.
+    """
+    ir = np.asarray(ir, dtype=float)
+    red = np.asarray(red, dtype=float)
+    q = {'ok': False, 'reason': None, 'dc': float(ir.mean()), 'clipped': 0.0,
+         'perfusion': None, 'skewness': None, 'periodicity': None}
+
+    # Raw checks first: no filtering for a window that is obviously unusable
+    clipped = (ir >= ADC_FULL_SCALE - CLIP_MARGIN) | (red >= ADC_FULL_SCALE - CLIP_MARGIN) | \
+              (ir <= CLIP_MARGIN) | (red <= CLIP_MARGIN)
+    q['clipped'] = float(clipped.mean())
+    if q['dc'] < MIN_DC:
+        q['reason'] = 'no_contact'
+        return q
+    if q['clipped'] > MAX_CLIPPED_FRACTION:
+        q['reason'] = 'clipping'
+        return q
+
+    bp = sosfiltfilt(sos, ir - q['dc'])
+    std = bp.std()
+    q['perfusion'] = float(std / q['dc'])
+    if not MIN_PERFUSION <= q['perfusion'] <= MAX_PERFUSION:
+        q['reason'] = 'low_perfusion' if q['perfusion'] < MIN_PERFUSION else 'motion'
+        return q
+    q['skewness'] = float(np.mean(bp ** 3) / std ** 3)
+
+    # Normalized autocorrelation (via FFT) at the lags of plausible heart rates
+    n = len(bp)
+    spectrum = np.fft.rfft(bp, 2 * n)
+    acf = np.fft.irfft(spectrum * np.conj(spectrum))[:n]
+    lo = int(sample_rate * 60 / HR_LAG_BPM[1])
+    hi = min(n - 1, int(sample_rate * 60 / HR_LAG_BPM[0]))
+    q['periodicity'] = float(acf[lo:hi + 1].max() / acf[0]) if hi > lo else 0.0
+
+    if abs(q['skewness']) < MIN_ABS_SKEWNESS:
+        q['reason'] = 'no_pulse_shape'
+    elif q['periodicity'] < MIN_PERIODICITY:
+        q['reason'] = 'not_periodic'
+    else:
+        q['ok'] = True
+    return q
+
+def assess(ir, red, sample_rate, sos, window_sec=SQI_WINDOW_SEC):
+    """
+    SQI of consecutive windows over a whole recording (a short tail joins the
+    last window). Returns (good, windows): a per-sample boolean mask and the
+    per-window dicts with their start / end sample.
+    """
+    n = len(ir)
+    size = max(1, int(window_sec * sample_rate))
+    starts = list(range(0, max(n - size, 0) + 1, size)) if n >= size else [0]
+    good = np.zeros(n, dtype=bool)
+    windows = []
+    for k, lo in enumerate(starts):
+        hi = n if k == len(starts) - 1 else lo + size
+        q = window_quality(ir[lo:hi], red[lo:hi], sample_rate, sos)
+        q.update(start=lo, end=hi)
+        good[lo:hi] = q['ok']
+        windows.append(q)
+    return good, windows
+
+def summarize(windows, sample_rate):
+    """Compact report: fraction of good signal and the rejected windows (in seconds)."""
+    total = sum(w['end'] - w['start'] for w in windows)
+    good = sum(w['end'] - w['start'] for w in windows if w['ok'])
+    return {
+        'good_fraction': good / total if total else 0.0,
+        'rejected': [{'start_s': w['start'] / sample_rate, 'end_s': w['end'] / sample_rate, 'reason': w['reason']}
+                     for w in windows if not w['ok']],
+    }
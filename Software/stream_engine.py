@@ -0,0 +1,342 @@
+# stream_engine.py
+# Incremental processor: same Pan-Tompkins chain as filtering.py, but it keeps
+# filter state and only processes newly arrived samples, so the cost of a metrics
+# update no longer grows with the length of the recording
+
+from collections import deque
+
+import numpy as np
+from scipy.signal import find_peaks
+
+from filtering import (SAMPLE_RATE, TRIM_START_SECONDS, CausalFilter, bandpass_sos,
+                       INTEGRATION_WINDOW_SEC, MIN_PEAK_DIST_SEC, PEAK_HEIGHT_FACTOR,
+                       PEAK_PROMINENCE_FACTOR, RR_LOWER_FACTOR, RR_UPPER_FACTOR, SPO2_DELAY_SEC)
+from signal_quality import SQI_WINDOW_SEC, window_quality
+from window_metrics import BeatWindow, SampleWindow
+
+# ================================================================
+# TUNABLE CONSTANTS
+# ================================================================
+WINDOW_SECONDS = 30.0                # Recent samples kept for the peak thresholds
+METRIC_WINDOWS = {'10s': 10.0, '30s': 30.0, '5min': 300.0}   # Sliding windows reported under metrics()['windows']
+MAIN_WINDOW = '30s'                  # Window the top-level SpO2 / perfusion / respiration come from
+SEARCH_SECONDS = 5.0                 # Integrated signal re-scanned for peaks per update (bounds the work)
+MAX_GAP_SECONDS = 2.0                # Longer gaps restart the filters instead of being interpolated
+ENVELOPE_POINTS_PER_SEC = 50         # Live waveform: min/max pairs per second (WaveformEnvelope)
+RR_HISTORY = 15                      # Recent RR intervals the median for RR cleaning is taken over
+MIN_WINDOW_SECONDS = 5.0             # Samples needed before SpO2/perfusion are reported
+BEAT_CONFIRM_SEC = 0.15              # A peak this old counts as a beat once the pulse has fallen off...
+BEAT_RELEASE_FACTOR = 0.5            # ...to this fraction of the peak height
+
+# ================================================================
+# INCREMENTAL ENGINE
+# ================================================================
+class IncrementalEngine:
+    """
+    Feed blocks of (idx, IR, Red) as they arrive; metrics() summarizes them.
+    The bandpass runs causally (filtering.CausalFilter, IR and Red as two
+    channels), the derivative is a causal central difference and the integrator
+    a running sum, so each sample is filtered exactly once. Peaks are searched
+    only in the last SEARCH_SECONDS of the integrated signal and confirmed once
+    they are BEAT_CONFIRM_SEC old and the pulse has fallen below
+    BEAT_RELEASE_FACTOR of them; beat times are moved back by the chain's delay
+    (bandpass group delay + derivative + integrator) so they match the
+    zero-phase offline path, and on_beat(index, rr_ms) fires as each beat is
+    confirmed (rr_ms None for the first of a segment); on_filtered(start, ir_bp)
+    gets every block of bandpassed IR (live waveform). HR/RMSSD/SDNN are running sums over every accepted RR
+    interval of the session; each of METRIC_WINDOWS also keeps them over its
+    own span (window_metrics.BeatWindow), plus running AC/DC sums for SpO2 /
+    perfusion and a sliding DFT for respiration (SampleWindow). The top-level
+    SpO2 / perfusion / respiration come from MAIN_WINDOW. Work per
+    update depends on the update size, not on the session or window length.
+    With gate=True every SQI_WINDOW_SEC of raw samples gets a signal-quality
+    verdict (signal_quality.window_quality()); after a rejected window the chain
+    is skipped (no filtering, no peak search) until a window passes again, then
+    restarts as after a gap. The verdict comes at the end of its window, so the
+    beats of the rejected window itself have already been reported.
+    """
+
+    def __init__(self, sample_rate=SAMPLE_RATE, on_beat=None, gate=True, on_filtered=None):
+        self.fs = sample_rate
+        self.on_beat = on_beat
+        self.on_filtered = on_filtered
+        self.gate = gate
+        self.sqi_size = int(SQI_WINDOW_SEC * sample_rate)
+        self.sqi_ir = np.empty(self.sqi_size)
+        self.sqi_red = np.empty(self.sqi_size)
+        self.bandpass = CausalFilter(bandpass_sos(sample_rate), sample_rate)
+        self.win = max(1, int(INTEGRATION_WINDOW_SEC * sample_rate))
+        self.min_dist = int(MIN_PEAK_DIST_SEC * sample_rate)
+        self.settle = int(TRIM_START_SECONDS * sample_rate)
+        self.capacity = int(WINDOW_SECONDS * sample_rate)
+        self.search = int(SEARCH_SECONDS * sample_rate)
+        self.confirm = int(BEAT_CONFIRM_SEC * sample_rate)
+        # Causal delay of the bandpass (group delay at the pulse upstroke), the
+        # derivative (1) and the integrator (half window) vs. the raw signal
+        self.delay = int(round(self.bandpass.delay)) + 1 + (self.win - 1) // 2
+        self.spo2_delay = int(SPO2_DELAY_SEC * sample_rate)   # Red lags IR by this much in the R ratio
+        self.beat_windows = {name: BeatWindow(int(sec * sample_rate)) for name, sec in METRIC_WINDOWS.items()}
+        self.sample_windows = {name: SampleWindow(int(sec * sample_rate), sample_rate)
+                               for name, sec in METRIC_WINDOWS.items()}
+        self.origin = None
+        self.reset_session()
+
+    def reset_session(self):
+        """Forgets everything (new recording)."""
+        self.origin = None
+        self.rr_n = 0
+        self.hr_sum = 0.0
+        self.rr_sum = 0.0
+        self.rr_sq_sum = 0.0
+        self.diff_n = 0
+        self.diff_sq_sum = 0.0
+        self.prev_rr = None
+        self.rr_recent = deque(maxlen=RR_HISTORY)
+        self.beats = deque()
+        self.samples = 0
+        self.rejected_windows = 0
+        for window in self.beat_windows.values():
+            window.reset()
+        self._restart(None)
+
+    def _restart(self, first_idx):
+        """Restarts the timeline and the filter chain (start of session or after a long gap)."""
+        self.next_idx = first_idx
+        self.last_raw = None
+        self.sqi_fill = 0
+        self.quality = None                   # Verdict of the latest complete SQI window
+        self.contact_ok = True                # Until the first verdict
+        self._restart_chain(first_idx)
+
+    def _restart_chain(self, first_idx):
+        """Restarts the filter chain at first_idx; settles again before beats are searched."""
+        self.bandpass.reset()
+        self.bp_tail = np.zeros(2)            # Last two bandpassed IR samples (derivative)
+        self.sq_tail = np.zeros(self.win - 1) # Last win-1 squared samples (integrator)
+        self.segment_start = first_idx        # First sample after the restart
+        self.last_beat = None
+        # Recent integrated signal for the peak search, absolute index of each sample in idx_ring
+        self.idx_ring = np.empty(0, dtype=np.int64)
+        self.integ_ring = np.empty(0)
+        self.red_bp_tail = None               # Bandpassed Red not yet paired with IR (SPO2_DELAY_SEC)
+        for window in self.sample_windows.values():
+            window.reset()                    # Filter restart: only settled samples enter the windows
+
+    def feed(self, idx, ir, red):
+        """Adds a block of samples with absolute indices (ascending)."""
+        idx = np.asarray(idx, dtype=np.int64)
+        ir = np.asarray(ir, dtype=float)
+        red = np.asarray(red, dtype=float)
+        if len(idx) == 0:
+            return
+        if self.origin is None:
+            self.origin = int(idx[0])
+        if self.next_idx is not None:
+            keep = idx >= self.next_idx               # Late duplicates (e.g. backfill overlap)
+            idx, ir, red = idx[keep], ir[keep], red[keep]
+            if len(idx) == 0:
+                return
+        if self.next_idx is not None and idx[0] - self.next_idx > MAX_GAP_SECONDS * self.fs:
+            print(f"[ENGINE] Gap of {idx[0] - self.next_idx} samples – restarting filters")
+            self._restart(None)
+        if self.next_idx is None:
+            self._restart(int(idx[0]))
+
+        # Place the block on the contiguous timeline, linearly filling the gaps
+        # (including the one before the first new sample)
+        start = self.next_idx if self.last_raw is not None else int(idx[0])
+        n = int(idx[-1]) - start + 1
+        pos = idx - start
+        t = np.arange(n)
+        if self.last_raw is not None:
+            pos_ext = np.concatenate(([-1], pos))
+            ir_t = np.interp(t, pos_ext, np.concatenate(([self.last_raw[0]], ir)))
+            red_t = np.interp(t, pos_ext, np.concatenate(([self.last_raw[1]], red)))
+        else:
+            ir_t = np.interp(t, pos, ir)
+            red_t = np.interp(t, pos, red)
+        self.last_raw = (ir_t[-1], red_t[-1])
+        self.next_idx = start + n
+        self.samples += len(idx)
+        if self.gate:
+            self._gate(start, ir_t, red_t)
+        else:
+            self._process(start, ir_t, red_t)
+
+    def _gate(self, start, ir, red):
+        """Processes the block while the signal is usable and judges each complete SQI window."""
+        pos = 0
+        while pos < len(ir):
+            take = min(len(ir) - pos, self.sqi_size - self.sqi_fill)
+            self.sqi_ir[self.sqi_fill:self.sqi_fill + take] = ir[pos:pos + take]
+            self.sqi_red[self.sqi_fill:self.sqi_fill + take] = red[pos:pos + take]
+            if self.contact_ok:
+                self._process(start + pos, ir[pos:pos + take], red[pos:pos + take])
+            self.sqi_fill += take
+            pos += take
+            if self.sqi_fill < self.sqi_size:
+                continue
+            self.sqi_fill = 0
+            self.quality = window_quality(self.sqi_ir, self.sqi_red, self.fs, self.bandpass.sos)
+            ok = self.quality['ok']
+            if not ok:
+                self.rejected_windows += 1
+            if ok and not self.contact_ok:
+                print("[ENGINE] Signal usable again – restarting filters")
+                self._restart_chain(start + pos)
+            elif not ok and self.contact_ok:
+                self.last_beat = None             # No RR interval across the rejected stretch
+                print(f"[ENGINE] Signal rejected ({self.quality['reason']}) – pausing processing")
+            self.contact_ok = ok
+
+    def _process(self, start, ir, red):
+        bp = self.bandpass.process(np.column_stack((ir, red)))
+        ir_bp, red_bp = bp[:, 0], bp[:, 1]
+        if self.on_filtered is not None:
+            self.on_filtered(start, ir_bp)
+
+        # Causal central difference and running-sum integrator
+        bp = np.concatenate((self.bp_tail, ir_bp))
+        deriv = (bp[2:] - bp[:-2]) / 2
+        self.bp_tail = bp[-2:]
+        sq = np.concatenate((self.sq_tail, deriv ** 2))
+        csum = np.concatenate(([0.0], np.cumsum(sq)))
+        integ = (csum[self.win:] - csum[:-self.win]) / self.win
+        self.sq_tail = sq[len(sq) - (self.win - 1):] if self.win > 1 else np.empty(0)
+
+        def keep(ring, new):
+            return np.concatenate((ring, new))[-self.capacity:]
+
+        self.idx_ring = keep(self.idx_ring, np.arange(start, start + len(ir), dtype=np.int64))
+        self.integ_ring = keep(self.integ_ring, integ)
+        self._update_windows(start, ir, red, ir_bp, red_bp)
+        self._find_beats()
+
+    def _update_windows(self, start, ir, red, ir_bp, red_bp):
+        """Settled samples into the sliding windows, Red delayed by spo2_delay."""
+        if self.red_bp_tail is None:
+            self.red_bp_tail = np.full(self.spo2_delay, red_bp[0])
+        red_all = np.concatenate((self.red_bp_tail, red_bp))
+        red_delayed = red_all[:len(red_bp)]
+        self.red_bp_tail = red_all[len(red_bp):]
+        first = max(0, self.segment_start + self.settle - start)
+        if first >= len(ir):
+            return
+        for window in self.sample_windows.values():
+            window.push(ir[first:], red[first:], ir_bp[first:], red_delayed[first:])
+        newest = start + len(ir) - 1
+        for window in self.beat_windows.values():
+            window.evict(newest)
+
+    def _find_beats(self):
+        newest = int(self.idx_ring[-1])
+        ring_start = int(self.idx_ring[0])
+        settled = self.segment_start + self.settle
+        if newest < settled + self.confirm:
+            return
+        lo = max(ring_start, settled, newest - self.search)
+        if self.last_beat is not None:
+            lo = max(lo, self.last_beat + self.min_dist)
+        if lo >= newest:
+            return
+        # Thresholds from the settled part of the recent window, as filtering.py does over the trimmed file
+        ref = self.integ_ring[max(0, settled - ring_start):]
+        segment = self.integ_ring[lo - ring_start:]
+        peaks, _ = find_peaks(segment,
+                              distance=self.min_dist,
+                              height=PEAK_HEIGHT_FACTOR * ref.max(),
+                              prominence=PEAK_PROMINENCE_FACTOR * ref.std())
+        for p in peaks:
+            peak = lo + int(p)
+            if newest - peak < self.confirm or \
+                    segment[p:].min() > BEAT_RELEASE_FACTOR * segment[p]:
+                break                         # Still on this pulse: a larger peak may follow
+            self._confirm_beat(peak)
+
+    def _confirm_beat(self, peak):
+        rr = None
+        if self.last_beat is not None:
+            rr = (peak - self.last_beat) / self.fs * 1000
+            self._add_rr(peak, rr)
+        self.last_beat = peak
+        beat = peak - self.delay
+        self.beats.append(beat)
+        while self.beats and self.beats[0] < self.idx_ring[0]:
+            self.beats.popleft()
+        if self.on_beat is not None:
+            self.on_beat(beat, rr)
+
+    def _add_rr(self, beat, rr):
+        self.rr_recent.append(rr)
+        median_rr = np.median(self.rr_recent)
+        if not (RR_LOWER_FACTOR * median_rr < rr < RR_UPPER_FACTOR * median_rr):
+            return
+        for window in self.beat_windows.values():
+            window.add(beat, rr, self.prev_rr)
+        self.rr_n += 1
+        self.hr_sum += 60000 / rr
+        self.rr_sum += rr
+        self.rr_sq_sum += rr * rr
+        if self.prev_rr is not None:
+            self.diff_sq_sum += (rr - self.prev_rr) ** 2
+            self.diff_n += 1
+        self.prev_rr = rr
+
+    def metrics(self):
+        """Same keys as process_ppg_file(); values are None until available."""
+        m = {'mean_hr': None, 'rmssd': None, 'sdnn': None, 'spo2': None,
+             'perfusion_index_x10': None, 'respiration_rate': None,
+             'peaks': [int(b - self.origin) for b in self.beats] if self.origin is not None else []}
+        if self.rr_n > 0:
+            mean_rr = self.rr_sum / self.rr_n
+            m['mean_hr'] = self.hr_sum / self.rr_n
+            m['sdnn'] = float(np.sqrt(max(0.0, self.rr_sq_sum / self.rr_n - mean_rr ** 2)))
+            if self.diff_n > 0:
+                m['rmssd'] = float(np.sqrt(self.diff_sq_sum / self.diff_n))
+
+        # Window metrics: O(1) reads of the running sums
+        min_samples = MIN_WINDOW_SECONDS * self.fs
+        windowed = self.sample_windows[MAIN_WINDOW].metrics(min_samples)
+        if not self.contact_ok:
+            windowed = {key: None for key in windowed}    # Stale until the signal is usable again
+        m['spo2'] = windowed['spo2']
+        if m['mean_hr'] is not None:
+            m['perfusion_index_x10'] = windowed['perfusion_index_x10']
+            m['respiration_rate'] = windowed['respiration_rate']
+        m['quality'] = {'ok': self.contact_ok, 'rejected_windows': self.rejected_windows,
+                        **({key: self.quality[key] for key in ('reason', 'dc', 'clipped', 'perfusion')}
+                           if self.quality else {})}
+        m['windows'] = {name: {**self.beat_windows[name].metrics(), **self.sample_windows[name].metrics(min_samples)}
+                        for name in METRIC_WINDOWS}
+        return m
+
+# ================================================================
+# WAVEFORM ENVELOPE (live plot)
+# ================================================================
+class WaveformEnvelope:
+    """
+    Min/max per bucket of 1 / ENVELOPE_POINTS_PER_SEC s: a few points per second
+    that still show every pulse extreme, so a plot stays smooth at any input
+    rate. push() carries incomplete buckets over to the next call and returns
+    {'t0', 'dt', 'lo', 'hi'} (times in seconds) or None when no bucket completed.
+    """
+
+    def __init__(self, sample_rate, points_per_sec=ENVELOPE_POINTS_PER_SEC):
+        self.bucket = max(1, int(round(sample_rate / points_per_sec)))
+        self.dt = self.bucket / sample_rate
+        self.pending = np.empty(0)
+        self.pending_start = None
+
+    def push(self, start, x):
+        if self.pending_start is None or start != self.pending_start + len(self.pending):
+            self.pending, self.pending_start = np.empty(0), start    # Restart or gap: new buckets
+        x = np.concatenate((self.pending, x))
+        whole = len(x) // self.bucket * self.bucket
+        t0 = self.pending_start * self.dt / self.bucket
+        self.pending = x[whole:]
+        self.pending_start += whole
+        if whole == 0:
+            return None
+        buckets = x[:whole].reshape(-1, self.bucket)
+        return {'t0': t0, 'dt': self.dt,
+                'lo': buckets.min(axis=1).round(1).tolist(), 'hi': buckets.max(axis=1).round(1).tolist()}
@@ -0,0 +1,96 @@
+# synthetic_ppg.py
+# Synthetic MAX30102-style recordings for benchmarks and replay: a pulse train
+# with configurable HR / HRV, respiration and noise, and packet loss that
+# follows the firmware's packet and seq scheme
+
+import numpy as np
+import pandas as pd
+
+from session_archive import SAMPLES_PER_SEQ    # v1 chunk: one seq for two packets
+
+# ================================================================
+# TUNABLE CONSTANTS
+# ================================================================
+SAMPLE_RATE = 200
+DC_IR = 57000                        # Same level as test_data.csv
+DC_RED = 57000
+PERFUSION = 0.015                    # IR AC / DC
+RESP_BASELINE = 0.003                # Respiratory baseline wander, fraction of DC
+RESP_AMPLITUDE = 0.10                # Respiratory modulation of the pulse amplitude
+SAMPLE_MAX = (1 << 18) - 1           # 18-bit ADC
+SAMPLES_PER_PACKET = 16              # v1 packet (see ble_connection.py)
+LOSS_PATTERNS = ('none', 'random', 'burst', 'periodic')
+
+def pulse_template(fs):
+    """One beat: systolic peak plus a smaller dicrotic wave, 1 s long, peak 1."""
+    t = np.arange(fs) / fs
+    pulse = np.exp(-((t - 0.15) / 0.06) ** 2) + 0.35 * np.exp(-((t - 0.40) / 0.08) ** 2)
+    return pulse / pulse.max()
+
+def synth_ppg(duration_s, fs=SAMPLE_RATE, hr_bpm=72.0, hrv_ms=40.0, resp_rate=15.0,
+              noise=0.002, spo2=97.0, seed=0):
+    """
+    Returns (ir, red, beat_samples) as integer ADC arrays. RR intervals are
+    Gaussian around 60 / hr_bpm with hrv_ms spread; noise is white, relative to
+    DC. The Red/IR perfusion ratio follows the R = (110 - SpO2) / 25
+    calibration filtering.py uses.
+    """
+    rng = np.random.default_rng(seed)
+    n = int(duration_s * fs)
+    mean_rr = 60.0 / hr_bpm
+    rr = np.clip(rng.normal(mean_rr, hrv_ms / 1000.0, int(duration_s / mean_rr * 1.2) + 2), 0.3, 2.0)
+    beats = (np.cumsum(rr) * fs).astype(np.int64)
+    beats = beats[beats < n]
+
+    # Overlapping beats are summed: scatter-add the template at every beat
+    template = pulse_template(fs)
+    pos = beats[:, None] + np.arange(len(template))
+    inside = pos < n
+    ac = np.zeros(n)
+    np.add.at(ac, pos[inside], np.broadcast_to(template, pos.shape)[inside])
+
+    t = np.arange(n) / fs
+    resp = np.sin(2 * np.pi * resp_rate / 60.0 * t)
+    ac *= 1 + RESP_AMPLITUDE * resp
+    ratio = (110.0 - spo2) / 25.0
+    ir = DC_IR * (1 + RESP_BASELINE * resp + PERFUSION * ac + noise * rng.standard_normal(n))
+    red = DC_RED * (1 + RESP_BASELINE * resp + ratio * PERFUSION * ac + noise * rng.standard_normal(n))
+    return (np.clip(np.rint(ir), 0, SAMPLE_MAX).astype(np.int64),
+            np.clip(np.rint(red), 0, SAMPLE_MAX).astype(np.int64), beats)
+
+def packet_keep_mask(n_samples, pattern='none', rate=0.01, burst_packets=8,
+                     samples_per_packet=SAMPLES_PER_PACKET, seed=1):
+    """
+    Which packets arrive. rate is the fraction of packets lost: 'random' drops
+    them independently, 'burst' in runs of burst_packets (link fades),
+    'periodic' every 1/rate-th packet (scheduler stalls).
+    """
+    if pattern not in LOSS_PATTERNS:
+        raise ValueError(f"loss pattern must be one of {LOSS_PATTERNS}")
+    n_packets = -(-n_samples // samples_per_packet)
+    keep = np.ones(n_packets, dtype=bool)
+    if pattern == 'none' or rate <= 0:
+        return keep
+    rng = np.random.default_rng(seed)
+    if pattern == 'random':
+        keep = rng.random(n_packets) >= rate
+    elif pattern == 'burst':
+        starts = np.flatnonzero(rng.random(n_packets) < rate / burst_packets)
+        drop = (starts[:, None] + np.arange(burst_packets)).ravel()
+        keep[drop[drop < n_packets]] = False
+    else:
+        keep[::max(1, int(round(1 / rate)))] = False
+    return keep
+
+def recording_frame(ir, red, keep=None, samples_per_packet=SAMPLES_PER_PACKET, with_idx=True):
+    """
+    The received samples as the host stores them: seq is the firmware's u8 chunk
+    counter (SAMPLES_PER_SEQ samples each), idx the absolute sample index (v2).
+    """
+    received = np.ones(len(ir), dtype=bool) if keep is None else \
+        np.repeat(keep, samples_per_packet)[:len(ir)]
+    idx = np.flatnonzero(received)
+    frame = {'seq': (idx // SAMPLES_PER_SEQ) & 0xFF, 'IR': ir[idx], 'Red': red[idx]}
+    if with_idx:
+        frame['idx'] = idx
+    return pd.DataFrame(frame)
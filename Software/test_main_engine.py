@@ -1,37 +1,26 @@
 # test_main_engine.py
 # Minimal test runner — only starts processing thread + GUI
+# The replay feeds recorded packets through the BLE receive path into the same
+# sample ring the live listener fills
+#
+# Usage: python test_main_engine.py [speed]   (multiple of real time, default 1)
 
 import threading
 import subprocess
-import time
 import os
-import json
-from filtering import process_ppg_file
-import pandas as pd
-
-CSV_FILE = "latest_ppg_data.csv"
-METRICS_FILE = "latest_metrics.json"
-MIN_SAMPLES = 1000
-
-def processing_thread():
-    while True:
-        if os.path.exists(CSV_FILE):
-            try:
-                df = pd.read_csv(CSV_FILE)
-                if len(df) >= MIN_SAMPLES:
-                    metrics = process_ppg_file(CSV_FILE)
-                    with open(METRICS_FILE, "w") as f:
-                        json.dump(metrics or {}, f)
-            except Exception as e:
-                print(f"Processing error: {e}")
-        time.sleep(5)
+import sys
+import asyncio
+from control_plane import plane
+from main_engine import processing_thread     # Same loop as live: metrics, beats, waveform
+from test_replay import replay_csv
 
 if __name__ == "__main__":
     os.chdir(os.path.dirname(os.path.abspath(__file__)))
+    plane.serve()
 
     # Start replay in background
-    threading.Thread(target=lambda: __import__('test_replay').asyncio.run(
-        __import__('test_replay').replay_csv()), daemon=True).start()
+    speed = float(sys.argv[1]) if len(sys.argv) > 1 else 1.0
+    threading.Thread(target=lambda: asyncio.run(replay_csv(speed=speed)), daemon=True).start()
 
     # Start processing and GUI
     threading.Thread(target=processing_thread, daemon=True).start()
@@ -1,62 +1,222 @@
 # test_replay.py
-# CSV replay for testing: streams test_data.csv in real-time chunks
-# No BLE simulation, no packet reconstruction needed
+# Packet-level replay for testing: turns test_data.csv (or a synthetic
+# recording) into the notifications the firmware would send – v1 transmitChunk()
+# framing or v2 packed, with its seq numbers and optional packet drops – and
+# feeds them to the real receive path (SensorSession.notification_handler) at
+# 1x, Nx or full speed
+#
+# Usage: python test_replay.py [--speed 10 | --speed 0] [--format v2] [--loss burst --loss-rate 0.02]
+#                              [--synthetic 3600] [--process] [--wait]
 
+import argparse
 import asyncio
-import os
-import pandas as pd
+import threading
 import time
 
+import numpy as np
+import pandas as pd
+
+import ble_connection as ble
+from ble_connection import session, WIRE_FORMAT_V1, WIRE_FORMAT_V2_PACKED, V2_HEADER_SIZE, SAMPLE_BITS
+from control_plane import plane
+from sample_ring import RingReader
+from session_archive import SAMPLES_PER_SEQ, SessionFile, is_session_archive
+from synthetic_ppg import LOSS_PATTERNS, SAMPLE_MAX, synth_ppg, packet_keep_mask
+
 CSV_FILE = "test_data.csv"
-CONNECTED_FLAG = "ble_connected.txt"
-START_FLAG = "start.txt"
-STOP_FLAG = "stop.txt"
+MIN_TEST_SECONDS = 30
 SAMPLE_RATE = 200
-CHUNK_SIZE = 200
+V1_BATCH_SIZE = 16                   # Firmware BATCH_SIZE: 129-byte packets
+V2_SAMPLES_PER_PACKET = 51           # What a 247-byte ATT MTU fits (244-byte notification)
+YIELD_PACKETS = 64                   # Full speed: let the other tasks/threads run this often
 
-async def replay_csv(csv_path="test_data.csv"):
-    open(CONNECTED_FLAG, "w").close()
+# ================================================================
+# PACKETIZER (mirrors buildPacket() in main.cpp)
+# ================================================================
+def encode_v2_packed(ir, red):
+    """IR/Red pairs as 18-bit fields, MSB first (packPayloadV2Packed)."""
+    count = len(ir)
+    groups = (count + 1) // 2
+    fields = np.zeros((groups * 2, 2), dtype=np.uint32)
+    fields[:count, 0] = ir
+    fields[:count, 1] = red
+    f = fields.reshape(groups, 4)
+    b = np.empty((groups, 9), dtype=np.uint8)
+    b[:, 0] = f[:, 0] >> 10
+    b[:, 1] = (f[:, 0] >> 2) & 0xFF
+    b[:, 2] = ((f[:, 0] & 0x03) << 6) | (f[:, 1] >> 12)
+    b[:, 3] = (f[:, 1] >> 4) & 0xFF
+    b[:, 4] = ((f[:, 1] & 0x0F) << 4) | (f[:, 2] >> 14)
+    b[:, 5] = (f[:, 2] >> 6) & 0xFF
+    b[:, 6] = ((f[:, 2] & 0x3F) << 2) | (f[:, 3] >> 16)
+    b[:, 7] = (f[:, 3] >> 8) & 0xFF
+    b[:, 8] = f[:, 3] & 0xFF
+    return b.tobytes()[:(count * 2 * SAMPLE_BITS + 7) // 8]
 
-    print(f"[REPLAY] Loading {csv_path}...")
-    df = pd.read_csv(csv_path)
-    total_samples = len(df)
-    print(f"[REPLAY] Loaded {total_samples} samples ({total_samples/SAMPLE_RATE:.1f}s)")
-
-    print("[REPLAY] Waiting for start.txt...")
-    while not os.path.exists(START_FLAG):
-        await asyncio.sleep(0.5)
-    os.remove(START_FLAG)
-    print("[REPLAY] Starting replay...")
-
-    start_time = time.time()
-    saved = 0
-
-    for i in range(0, total_samples, CHUNK_SIZE):
-        if os.path.exists(STOP_FLAG):
-            elapsed = time.time() - start_time
-            if elapsed >= 30:  # Respect minimum duration like real system
-                os.remove(STOP_FLAG)
-                print(f"[REPLAY] Stopped at {elapsed:.1f}s")
+def build_packets(ir, red, fmt=WIRE_FORMAT_V1, fs=SAMPLE_RATE, loss='none', loss_rate=0.0, seed=1):
+    """
+    Returns [(due_s, payload)] in send order: due_s is when the packet's last
+    sample was acquired. Dropped packets are left out, as if lost over the air;
+    seq and indices still advance for them like on the firmware.
+    """
+    ir = np.clip(np.asarray(ir, dtype=np.int64), 0, SAMPLE_MAX)
+    red = np.clip(np.asarray(red, dtype=np.int64), 0, SAMPLE_MAX)
+    per_packet = V1_BATCH_SIZE if fmt == WIRE_FORMAT_V1 else V2_SAMPLES_PER_PACKET
+    n_packets = len(ir) // per_packet          # Firmware only sends full v1 batches; keep v2 alike
+    keep = packet_keep_mask(n_packets * per_packet, loss, loss_rate, samples_per_packet=per_packet, seed=seed)
+    period_us = 1_000_000 // fs
+    packets = []
+    for p in np.flatnonzero(keep):
+        lo, hi = p * per_packet, (p + 1) * per_packet
+        if fmt == WIRE_FORMAT_V1:
+            seq = (1 + lo // SAMPLES_PER_SEQ) & 0xFF
+            body = np.empty((per_packet, 2), dtype='>u4')
+            body[:, 0] = ir[lo:hi]
+            body[:, 1] = red[lo:hi]
+            data = bytes([seq]) + body.tobytes()
+        else:
+            header = bytearray(V2_HEADER_SIZE)
+            header[0] = fmt
+            header[1] = (1 + p) & 0xFF
+            header[2] = per_packet
+            header[3:7] = int(lo).to_bytes(4, 'big')
+            header[7:11] = (int(lo) * period_us & 0xFFFFFFFF).to_bytes(4, 'big')
+            data = bytes(header) + encode_v2_packed(ir[lo:hi], red[lo:hi])
+        packets.append((hi / fs, data))
+    return packets
+
+# ================================================================
+# REPLAY
+# ================================================================
+async def replay(ir, red, fs=SAMPLE_RATE, fmt=WIRE_FORMAT_V1, speed=1.0, loss='none', loss_rate=0.0,
+                 wait_for_start=True):
+    """
+    Streams the recording through session.notification_handler(). speed is the
+    multiple of real time (0 = as fast as possible). Returns a summary dict.
+    """
+    packets = build_packets(ir, red, fmt, fs, loss, loss_rate)
+    session.reset()
+    session.start_archives()
+    session.wire_format = fmt
+    session.output_rate = fs
+    session.active_config = {'batch_size': V1_BATCH_SIZE, 'chunk_samples': SAMPLES_PER_SEQ, 'output_rate': fs}
+
+    events, unsubscribe = plane.asyncio_events(asyncio.get_running_loop(), 'start', 'stop')
+    plane.publish('connected', True)
+    print(f"[REPLAY] {len(ir)} samples ({len(ir) / fs:.1f}s) as {len(packets)} packets, "
+          f"format {fmt}, speed {'max' if speed <= 0 else f'{speed:g}x'}")
+    if wait_for_start:
+        print("[REPLAY] Waiting for start...")
+        await events['start'].wait()
+    events['stop'].clear()
+    archiver = asyncio.create_task(session.archive_task()) if ble.ARCHIVE_SESSION or ble.ARCHIVE_CSV else None
+
+    start_time = time.perf_counter()
+    sent = samples = 0
+    for due, data in packets:
+        if speed > 0:
+            delay = start_time + due / speed - time.perf_counter()
+            if delay > 0:
+                await asyncio.sleep(delay)
+        elif sent % YIELD_PACKETS == 0:
+            await asyncio.sleep(0)
+        if events['stop'].is_set():
+            events['stop'].clear()
+            if due >= MIN_TEST_SECONDS:  # Respect minimum (recording) duration like real system
+                print(f"[REPLAY] Stopped at {due:.1f}s of recording")
                 break
-            else:
-                os.remove(STOP_FLAG)
-        chunk = df.iloc[i:i + CHUNK_SIZE]
-        mode = 'a' if saved > 0 else 'w'
-        chunk.to_csv(CSV_FILE, mode=mode, header=(mode == 'w'), index=False)
-        saved += len(chunk)
-        print(f"[REPLAY] Streamed {saved}/{total_samples} samples")
-
-        # Simulate real-time playback
-        await asyncio.sleep(CHUNK_SIZE / SAMPLE_RATE)
-
-    if saved < total_samples:
-        final_chunk = df.iloc[saved:]
-        final_chunk.to_csv(CSV_FILE, mode='a', header=False, index=False)
-        print(f"[REPLAY] Final chunk: {len(final_chunk)} samples")
-
-    if os.path.exists(CONNECTED_FLAG):
-        os.remove(CONNECTED_FLAG)
-    print("[REPLAY] Finished")
+        session.notification_handler(None, data)
+        sent += 1
+        samples += V1_BATCH_SIZE if fmt == WIRE_FORMAT_V1 else V2_SAMPLES_PER_PACKET
+    elapsed = time.perf_counter() - start_time
+
+    if archiver is not None:
+        archiver.cancel()
+        saved = await asyncio.to_thread(session.flush_archives)
+        print(f"[ARCHIVE] Final save: {saved} samples")
+    unsubscribe()
+    plane.publish('connected', False)
+    summary = {'packets': sent, 'samples': samples, 'elapsed_s': elapsed,
+               'samples_per_s': samples / elapsed if elapsed > 0 else float('inf'),
+               'x_realtime': samples / fs / elapsed if elapsed > 0 else float('inf')}
+    print(f"[REPLAY] Finished: {sent} packets in {elapsed:.2f}s – "
+          f"{summary['samples_per_s']:.0f} samples/s ({summary['x_realtime']:.1f}x real time)")
+    return summary
+
+def load_recording(path):
+    """(ir, red) of a CSV recording or a session archive; samples lost in it are skipped."""
+    if is_session_archive(path):
+        archive = SessionFile(path)
+        return archive.ir, archive.red
+    df = pd.read_csv(path)
+    return df['IR'].values, df['Red'].values
+
+async def replay_csv(csv_path=CSV_FILE, **kwargs):
+    print(f"[REPLAY] Loading {csv_path}...")
+    ir, red = load_recording(csv_path)
+    return await replay(ir, red, **kwargs)
+
+# ================================================================
+# LOAD TEST: processing on the ring while the replay runs
+# ================================================================
+def processing_load(stop, result, fs=SAMPLE_RATE):
+    """Feeds the incremental engine as fast as the ring fills; records throughput and lag."""
+    from stream_engine import IncrementalEngine
+    reader = RingReader(session.ring, "load test")
+    engine = IncrementalEngine(sample_rate=fs)
+    busy = max_lag = processed = 0
+    while not stop.is_set() or session.ring.written > reader.cursor:
+        max_lag = max(max_lag, session.ring.written - reader.cursor)
+        records, restarted = reader.read_new()
+        if restarted:
+            engine = IncrementalEngine(sample_rate=fs)
+        if records is None:
+            time.sleep(0.001)
+            continue
+        t0 = time.perf_counter()
+        engine.feed(records['idx'], records['ir'], records['red'])
+        engine.metrics()
+        busy += time.perf_counter() - t0
+        processed += len(records)
+    result.update({'processed': processed, 'busy_s': busy, 'max_lag_samples': max_lag,
+                   'mean_hr': engine.metrics().get('mean_hr')})
+
+def main():
+    parser = argparse.ArgumentParser(description="Packet-level replay through the BLE receive path")
+    parser.add_argument('--csv', default=CSV_FILE, help="recording to replay (CSV or .ppgs session archive)")
+    parser.add_argument('--synthetic', type=float, help="replay a synthetic recording of this many seconds instead")
+    parser.add_argument('--rate', type=int, default=SAMPLE_RATE)
+    parser.add_argument('--format', choices=['v1', 'v2'], default='v1')
+    parser.add_argument('--speed', type=float, default=1.0, help="multiple of real time, 0 = as fast as possible")
+    parser.add_argument('--loss', default='none', choices=LOSS_PATTERNS)
+    parser.add_argument('--loss-rate', type=float, default=0.01)
+    parser.add_argument('--process', action='store_true', help="run the incremental engine concurrently and report its throughput")
+    parser.add_argument('--wait', action='store_true', help="wait for a 'start' event (GUI) before replaying")
+    args = parser.parse_args()
+
+    if args.synthetic:
+        ir, red, _ = synth_ppg(args.synthetic, fs=args.rate)
+    else:
+        ir, red = load_recording(args.csv)
+    fmt = WIRE_FORMAT_V1 if args.format == 'v1' else WIRE_FORMAT_V2_PACKED
+
+    stop, load = threading.Event(), {}
+    worker = threading.Thread(target=processing_load, args=(stop, load, args.rate), daemon=True)
+    if args.process:
+        worker.start()
+    summary = asyncio.run(replay(ir, red, args.rate, fmt, args.speed, args.loss, args.loss_rate,
+                                 wait_for_start=args.wait))
+    if args.process:
+        stop.set()
+        worker.join()
+        rate = load['processed'] / load['busy_s'] if load['busy_s'] > 0 else float('inf')
+        print(f"[REPLAY] Processing: {load['processed']} samples, {rate:.0f} samples/s when busy "
+              f"({rate / args.rate:.0f}x real time), max lag {load['max_lag_samples']} samples, "
+              f"HR {load['mean_hr']}")
+        # Sustainable if the processor kept up with ingest at this speed
+        if load['max_lag_samples'] >= session.ring.size:
+            print("[ERROR] Processing fell a full ring behind – ingest speed not sustainable")
 
 if __name__ == "__main__":
-    asyncio.run(replay_csv())
\ No newline at end of file
+    plane.serve()
+    main()
@@ -0,0 +1,151 @@
+# window_metrics.py
+# Sliding-window statistics for the incremental engine: HR / SDNN / RMSSD over
+# the beats of the last N seconds, perfusion / SpO2 from running AC / DC sums,
+# and respiration from a sliding DFT over the 0.1–0.5 Hz bins. Every update is
+# O(1) per new beat and O(bins) per new sample; nothing is recomputed over the
+# whole window except a periodic exact resync that bounds round-off drift.
+
+from collections import deque
+
+import numpy as np
+
+RESP_LOW_HZ = 0.1
+RESP_HIGH_HZ = 0.5
+
+# ================================================================
+# BEAT WINDOW (HR, SDNN, RMSSD)
+# ================================================================
+class BeatWindow:
+    """
+    Accepted RR intervals whose beat lies within the last `samples` samples.
+    SDNN is a Welford mean / M2 that also supports removal; RMSSD a running sum
+    of squared successive differences, each keyed on its later beat.
+    """
+
+    def __init__(self, samples):
+        self.samples = samples
+        self.reset()
+
+    def reset(self):
+        self.rr = deque()            # (beat index, rr ms, 60000 / rr)
+        self.diffs = deque()         # (beat index, squared successive difference)
+        self.mean = 0.0
+        self.m2 = 0.0
+        self.hr_sum = 0.0
+        self.diff_sum = 0.0
+
+    def add(self, beat, rr, prev_rr=None):
+        """rr ending at sample `beat`; prev_rr is the accepted interval before it, if any."""
+        hr = 60000 / rr
+        self.rr.append((beat, rr, hr))
+        self.hr_sum += hr
+        delta = rr - self.mean
+        self.mean += delta / len(self.rr)
+        self.m2 += delta * (rr - self.mean)
+        if prev_rr is not None:
+            d2 = (rr - prev_rr) ** 2
+            self.diffs.append((beat, d2))
+            self.diff_sum += d2
+
+    def evict(self, newest):
+        """Drops beats older than `samples` before sample `newest`."""
+        oldest = newest - self.samples
+        while self.rr and self.rr[0][0] < oldest:
+            _, rr, hr = self.rr.popleft()
+            self.hr_sum -= hr
+            if not self.rr:
+                self.mean = self.m2 = self.hr_sum = 0.0
+                continue
+            delta = rr - self.mean
+            self.mean -= delta / len(self.rr)
+            self.m2 -= delta * (rr - self.mean)
+        while self.diffs and self.diffs[0][0] < oldest:
+            self.diff_sum -= self.diffs.popleft()[1]
+        if not self.diffs:
+            self.diff_sum = 0.0
+
+    def metrics(self):
+        n = len(self.rr)
+        return {
+            'mean_hr': self.hr_sum / n if n else None,
+            'sdnn': float(np.sqrt(max(0.0, self.m2 / n))) if n else None,
+            'rmssd': float(np.sqrt(max(0.0, self.diff_sum / len(self.diffs)))) if self.diffs else None,
+            'beats': n,
+        }
+
+# ================================================================
+# SAMPLE WINDOW (PERFUSION, SPO2, RESPIRATION)
+# ================================================================
+class SampleWindow:
+    """
+    Last `samples` samples of (IR, Red, bandpassed IR, bandpassed Red) in a ring,
+    with running sums for DC (mean raw) and AC (std of the bandpassed signal) and
+    a sliding DFT of the bandpassed IR at the respiration bins. Slots not yet
+    written hold zeros, so a partly filled window needs no special casing.
+    """
+
+    def __init__(self, samples, sample_rate):
+        self.n = int(samples)
+        self.fs = sample_rate
+        k = np.arange(1, self.n // 2)
+        f = k * sample_rate / self.n
+        self.bins = k[(f > RESP_LOW_HZ) & (f < RESP_HIGH_HZ)]
+        self.omega = 2 * np.pi * self.bins / self.n
+        self.reset()
+
+    def reset(self):
+        self.buf = np.zeros((self.n, 4))
+        self.pos = 0
+        self.count = 0
+        self.since_sync = 0
+        self.sums = np.zeros(4)
+        self.sq_sums = np.zeros(4)
+        self.spectrum = np.zeros(len(self.bins), dtype=complex)
+
+    def push(self, ir, red, ir_bp, red_bp):
+        block = np.column_stack((ir, red, ir_bp, red_bp))
+        for lo in range(0, len(block), self.n):
+            self._push(block[lo:lo + self.n])
+        if self.since_sync >= self.n:
+            self._resync()
+
+    def _push(self, block):
+        b = len(block)
+        slots = (self.pos + np.arange(b)) % self.n
+        old = self.buf[slots]
+        self.buf[slots] = block
+        self.pos = (self.pos + b) % self.n
+        self.count = min(self.count + b, self.n)
+        self.since_sync += b
+        self.sums += block.sum(axis=0) - old.sum(axis=0)
+        self.sq_sums += (block ** 2).sum(axis=0) - (old ** 2).sum(axis=0)
+        if len(self.bins):
+            # S <- (S + x_new - x_old) * e^{jw} per sample, applied to the whole block
+            d = block[:, 2] - old[:, 2]
+            steps = b - np.arange(b)
+            self.spectrum = self.spectrum * np.exp(1j * self.omega * b) + \
+                d @ np.exp(1j * np.outer(steps, self.omega))
+
+    def _resync(self):
+        """Exact sums and spectrum from the ring; the sliding updates continue from here."""
+        window = np.roll(self.buf, -self.pos, axis=0)     # Oldest slot first
+        self.sums = window.sum(axis=0)
+        self.sq_sums = (window ** 2).sum(axis=0)
+        if len(self.bins):
+            self.spectrum = window[:, 2] @ np.exp(-1j * np.outer(np.arange(self.n), self.omega))
+        self.since_sync = 0
+
+    def metrics(self, min_samples):
+        m = {'spo2': None, 'perfusion_index_x10': None, 'respiration_rate': None}
+        if self.count < min_samples:
+            return m
+        mean = self.sums / self.count
+        std = np.sqrt(np.maximum(0.0, self.sq_sums / self.count - mean ** 2))
+        dc_ir, dc_red, ac_ir, ac_red = mean[0], mean[1], std[2], std[3]
+        if dc_ir > 0 and dc_red > 0 and ac_ir > 0:
+            m['perfusion_index_x10'] = int(ac_ir / dc_ir * 1000)
+            R = (ac_red / dc_red) / (ac_ir / dc_ir)
+            m['spo2'] = float(np.clip(110 - 25 * R, 85, 100))
+        if len(self.bins):
+            m['respiration_rate'] = float(self.bins[np.argmax(np.abs(self.spectrum))] * self.fs / self.n * 60)
+        return m